@@ -1,3 +1,13 @@
+#include <cstddef>
+
+// stb_image allocates through a per-thread arena while a StbiArenaScope is alive.
+void *stbiArenaMalloc(size_t size);
+void *stbiArenaRealloc(void *p, size_t oldSize, size_t newSize);
+void stbiArenaFree(void *p);
+
+#define STBI_MALLOC(sz) stbiArenaMalloc(sz)
+#define STBI_REALLOC_SIZED(p, oldsz, newsz) stbiArenaRealloc(p, oldsz, newsz)
+#define STBI_FREE(p) stbiArenaFree(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -9,11 +19,193 @@
 #include <cmath>
 #include <cstdlib>
 #include <cctype>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <cstdio>
+#include <numbers>
+#include <array>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <latch>
+#include <climits>
+#include <chrono>
+#include <charconv>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+
+// Bump allocator for stb_image's zlib, row and output buffers. Memory is only
+// handed back in bulk by reset(); when an image needed more than one block the
+// blocks are merged so the next image of that size decodes from a single one.
+class StbiArena {
+public:
+    void *allocate(size_t size) {
+        size = (size + kAlign - 1) & ~(kAlign - 1);
+        if (blocks_.empty() || used_ + size > blocks_.back().size) {
+            size_t blockSize = std::max(size, blocks_.empty() ? kMinBlock : blocks_.back().size * 2);
+            blocks_.push_back({std::make_unique<unsigned char[]>(blockSize), blockSize});
+            used_ = 0;
+        }
+        last_ = blocks_.back().data.get() + used_;
+        used_ += size;
+        return last_;
+    }
+
+    void *reallocate(void *p, size_t oldSize, size_t newSize) {
+        if (!p) return allocate(newSize);
+        if (p == last_) {
+            // Growing the most recent allocation (zlib output, mostly) stays in place.
+            const size_t start = static_cast<unsigned char *>(p) - blocks_.back().data.get();
+            const size_t size = (newSize + kAlign - 1) & ~(kAlign - 1);
+            if (start + size <= blocks_.back().size) {
+                used_ = start + size;
+                return p;
+            }
+        }
+        void *q = allocate(newSize);
+        std::memcpy(q, p, std::min(oldSize, newSize));
+        return q;
+    }
+
+    void release(void *p) {
+        // Only the most recent allocation can be rolled back; the rest waits for reset().
+        if (p && p == last_) {
+            used_ = static_cast<unsigned char *>(p) - blocks_.back().data.get();
+            last_ = nullptr;
+        }
+    }
+
+    bool owns(const void *p) const {
+        const auto *b = static_cast<const unsigned char *>(p);
+        for (const auto &block: blocks_)
+            if (b >= block.data.get() && b < block.data.get() + block.size) return true;
+        return false;
+    }
+
+    // Keeps at most kMaxRetained bytes for the next image; after a bigger
+    // decode the memory goes back to the heap rather than staying with the
+    // thread until it exits.
+    void reset() {
+        size_t total = 0;
+        for (const auto &block: blocks_) total += block.size;
+        if (total > kMaxRetained) {
+            blocks_.clear();
+        } else if (blocks_.size() > 1) {
+            blocks_.clear();
+            blocks_.push_back({std::make_unique<unsigned char[]>(total), total});
+        }
+        used_ = 0;
+        last_ = nullptr;
+    }
+
+    int depth = 0; // active StbiArenaScope nesting on this thread
+
+private:
+    static constexpr size_t kAlign = alignof(std::max_align_t);
+    static constexpr size_t kMinBlock = 1 << 20;
+    static constexpr size_t kMaxRetained = 64 << 20;
+
+    struct Block {
+        std::unique_ptr<unsigned char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t used_ = 0; // bytes handed out from blocks_.back()
+    void *last_ = nullptr;
+};
+
+static thread_local StbiArena stbiArena;
+
+// While alive, stb_image on this thread allocates from the thread's arena, which
+// is reset when the outermost scope ends. Anything stb_image returned inside the
+// scope (including stbi_load pixels) must be copied out before then.
+struct StbiArenaScope {
+    StbiArenaScope() { ++stbiArena.depth; }
+    ~StbiArenaScope() {
+        if (--stbiArena.depth == 0) stbiArena.reset();
+    }
+    StbiArenaScope(const StbiArenaScope &) = delete;
+    StbiArenaScope &operator=(const StbiArenaScope &) = delete;
+};
+
+void *stbiArenaMalloc(size_t size) {
+    return stbiArena.depth ? stbiArena.allocate(size) : std::malloc(size);
+}
+
+void *stbiArenaRealloc(void *p, size_t oldSize, size_t newSize) {
+    if (p ? stbiArena.owns(p) : stbiArena.depth > 0) return stbiArena.reallocate(p, oldSize, newSize);
+    return std::realloc(p, newSize);
+}
+
+void stbiArenaFree(void *p) {
+    if (!p) return;
+    if (stbiArena.owns(p)) stbiArena.release(p);
+    else std::free(p);
+}
+
+static void appendUInt(std::string &out, unsigned v) {
+    char buf[10];
+    int n = 0;
+    do {
+        buf[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) out += buf[--n];
+}
+
+// Voice, speaking rate and pitch for one engine call. Unset fields (empty or
+// zero) take the defaults from setSpeechDefaults, and then the engine's own.
+struct SpeechOptions {
+    std::string voice; // engine voice name, e.g. "en-us" (espeak) or "Alex" (say)
+    int rate = 0;      // words per minute
+    int pitch = 0;     // 1-99, 50 being the voice's normal pitch
 
+    bool operator==(const SpeechOptions &) const = default;
+};
+
+// Appends options in a form fit for cache and dedupe keys.
+static void appendSpeechOptionsKey(std::string &key, const SpeechOptions &options) {
+    key += options.voice;
+    key += '\0';
+    appendUInt(key, static_cast<unsigned>(options.rate));
+    key += '/';
+    appendUInt(key, static_cast<unsigned>(options.pitch));
+}
 
-void speakText(const std::string &text);
+void speakText(const std::string &text, const SpeechOptions &options = {});
+void speakMarkup(std::string_view markup, const SpeechOptions &options = {});
+static void speakRaw(const std::string &text, bool markup = false, const SpeechOptions &options = {});
 
-static std::string threeDigitsToWords(int num) {
+static void appendThreeDigits(std::string &out, int num) {
     static const std::vector<std::string> below20{
         "", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine",
         "ten", "eleven", "twelve", "thirteen", "fourteen", "fifteen",
@@ -23,259 +215,4731 @@ static std::string threeDigitsToWords(int num) {
         "", "", "twenty", "thirty", "forty", "fifty", "sixty", "seventy", "eighty", "ninety"
     };
 
-    std::string res;
     int hundred = num / 100;
     int rest = num % 100;
 
     if (hundred) {
-        res += below20[hundred] + " hundred";
-        if (rest) res += " ";
+        out += below20[hundred];
+        out += " hundred";
+        if (rest) out += ' ';
     }
     if (rest) {
         if (rest < 20) {
-            res += below20[rest];
+            out += below20[rest];
         } else {
             int t = rest / 10;
             int u = rest % 10;
-            res += tens[t];
-            if (u) res += "-" + below20[u];
+            out += tens[t];
+            if (u) {
+                out += '-';
+                out += below20[u];
+            }
         }
     }
-    return res;
 }
 
-std::string numberToWords(long long num) {
-    if (num == 0) return "zero";
+// Appends the English cardinal for num; covers the whole long long range.
+void appendNumberWords(std::string &out, long long num) {
+    if (num == 0) {
+        out += "zero";
+        return;
+    }
 
-    std::string sign;
+    // Work on the unsigned magnitude so LLONG_MIN does not overflow
+    unsigned long long n = static_cast<unsigned long long>(num);
     if (num < 0) {
-        sign = "minus ";
-        num = std::llabs(num);
+        out += "minus ";
+        n = 0ULL - n;
     }
 
-    static const std::vector<std::pair<long long, std::string> > units{
-        {1'000'000'000'000LL, "trillion"},
-        {1'000'000'000LL, "billion"},
-        {1'000'000LL, "million"},
-        {1'000LL, "thousand"},
-        {1LL, ""}
+    static const std::vector<std::pair<unsigned long long, std::string> > units{
+        {1'000'000'000'000'000'000ULL, "quintillion"},
+        {1'000'000'000'000'000ULL, "quadrillion"},
+        {1'000'000'000'000ULL, "trillion"},
+        {1'000'000'000ULL, "billion"},
+        {1'000'000ULL, "million"},
+        {1'000ULL, "thousand"},
+        {1ULL, ""}
     };
 
+    bool first = true;
+    for (const auto &[value, name]: units) {
+        if (n >= value) {
+            int chunk = static_cast<int>(n / value);
+            n %= value;
+
+            if (!first) out += ' ';
+            first = false;
+            appendThreeDigits(out, chunk);
+            if (!name.empty()) {
+                out += ' ';
+                out += name;
+            }
+        }
+    }
+}
+
+std::string numberToWords(long long num) {
     std::string result;
-    for (auto [value, name]: units) {
-        if (num >= value) {
-            int chunk = static_cast<int>(num / value);
-            num %= value;
+    appendNumberWords(result, num);
+    return result;
+}
+
+// ---- Pronunciation lexicon ---------------------------------------------------
+// User respellings for words the engine gets wrong ("Morizo", product codes).
+// Source files hold one "word<TAB>replacement" per line ('#' starts a comment);
+// keys are case-insensitive. The compiled form is a single position-independent
+// blob, a hash-and-displace perfect hash over a string pool, that can be saved
+// and mapped straight back in:
+//
+//   header | buckets[bucketCount] (uint32) | slots[slotCount] | key/value pool
+//
+// Each bucket word holds a 16-bit displacement seed and a 16-bit filter with one
+// bit set per key in the bucket. A lookup lowercases and hashes the token in one
+// pass and reads its bucket word; most misses stop there. Otherwise it reads
+// one slot and touches the pool only when the slot's hash tag matches. The
+// bucket table (about 1.3 bytes per key) stays cache-resident, so a miss costs
+// at most one cold load and a hit two.
+
+class PronunciationLexicon {
+public:
+    PronunciationLexicon() = default;
+    PronunciationLexicon(const PronunciationLexicon &) = delete;
+    PronunciationLexicon &operator=(const PronunciationLexicon &) = delete;
+    ~PronunciationLexicon() { unmap(); }
+
+    // Builds the lexicon in memory. Later duplicates of a key win.
+    bool build(const std::vector<std::pair<std::string, std::string> > &entries) {
+        unmap();
+        return buildBlob(entries, owned_) && attach(owned_.data(), owned_.size());
+    }
+
+    // Loads either a compiled blob (mapped when the platform allows) or a
+    // word<TAB>replacement text file.
+    bool load(const std::string &path) {
+        char magic[4] = {};
+        {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) return false;
+            in.read(magic, sizeof(magic));
+        }
+        if (std::memcmp(magic, kMagic, sizeof(magic)) == 0) return mapBlob(path);
+
+        std::ifstream in(path);
+        std::vector<std::pair<std::string, std::string> > entries;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            const size_t tab = line.find('\t');
+            if (line.empty() || line[0] == '#' || tab == std::string::npos || tab == 0) continue;
+            entries.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+        }
+        return build(entries);
+    }
+
+    // Writes the compiled blob for a later load().
+    bool save(const std::string &path) const {
+        std::ofstream out(path, std::ios::binary);
+        out.write(data_, static_cast<std::streamsize>(size_));
+        return static_cast<bool>(out);
+    }
+
+    // Replacement for word, or an empty view when there is none.
+    std::string_view lookup(std::string_view word) const {
+        if (!header_ || word.empty() || word.size() > kMaxKey) return {};
+        char key[kMaxKey + 8];
+        const uint64_t h = hashLowered(word, key);
+        const uint32_t bucket = buckets_[reduce(h, header_->bucketCount)];
+        if (!(bucket & filterBit(h))) return {};
+        const Slot &slot = slots_[reduce(mixSeed(h, static_cast<uint16_t>(bucket)), header_->slotCount)];
+        if (slot.tag != tagOf(h)) return {};
+        const char *entry = pool_ + slot.offset;
+        const size_t keyLen = static_cast<unsigned char>(entry[0]);
+        const size_t valueLen = static_cast<unsigned char>(entry[1]) | static_cast<unsigned char>(entry[2]) << 8;
+        if (keyLen != word.size() || std::memcmp(entry + 3, key, keyLen) != 0) return {};
+        return {entry + 3 + keyLen, valueLen};
+    }
+
+    size_t size() const { return header_ ? header_->count : 0; }
+    size_t bytes() const { return size_; }
+
+private:
+    static constexpr char kMagic[4] = {'P', 'L', 'X', '1'};
+    static constexpr size_t kMaxKey = 255;
+
+    struct Header {
+        char magic[4];
+        uint32_t count;
+        uint32_t bucketCount;
+        uint32_t slotCount;
+        uint32_t poolSize;
+    };
+
+    // Pool entries are [keyLen:1][valueLen:2 LE][key][value]
+    struct Slot {
+        uint32_t tag; // low hash bits | 1; 0 marks an empty slot
+        uint32_t offset;
+    };
+
+    // ASCII A-Z to lower case, eight bytes at a time; other bytes unchanged.
+    static uint64_t lowerAscii8(uint64_t w) {
+        constexpr uint64_t ones = 0x0101010101010101ULL;
+        const uint64_t low7 = w & (0x7F * ones);
+        const uint64_t atLeastA = low7 + (0x80 - 'A') * ones;
+        const uint64_t aboveZ = low7 + (0x80 - 'Z' - 1) * ones;
+        const uint64_t upper = (atLeastA & ~aboveZ & ~w) & (0x80 * ones);
+        return w | (upper >> 2);
+    }
+
+    // Lowercases word into key (which needs 8 bytes of slack) and hashes it.
+    static uint64_t hashLowered(std::string_view word, char *key) {
+        const char *p = word.data();
+        size_t n = word.size();
+        uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+        for (; n >= 8; p += 8, n -= 8, key += 8) {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            w = lowerAscii8(w);
+            std::memcpy(key, &w, 8);
+            h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 31;
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, p, n);
+        tail = lowerAscii8(tail);
+        std::memcpy(key, &tail, 8);
+        h = (h ^ tail) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 29);
+    }
+
+    static uint32_t tagOf(uint64_t h) { return static_cast<uint32_t>(h) | 1; }
+    static uint32_t filterBit(uint64_t h) { return 0x10000u << ((h >> 8) & 15); }
+
+    static uint64_t mixSeed(uint64_t h, uint16_t seed) {
+        h ^= (seed + 1) * 0x9E3779B97F4A7C15ULL;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        return h ^ (h >> 32);
+    }
+
+    // Maps the high 32 bits of h onto [0, n) without a division.
+    static uint32_t reduce(uint64_t h, uint32_t n) {
+        return static_cast<uint32_t>(((h >> 32) * n) >> 32);
+    }
+
+    static size_t bucketsOffset() { return sizeof(Header); }
+    static size_t slotsOffset(const Header &h) { return bucketsOffset() + static_cast<size_t>(h.bucketCount) * 4; }
+    static size_t poolOffset(const Header &h) { return slotsOffset(h) + static_cast<size_t>(h.slotCount) * sizeof(Slot); }
+
+    static bool buildBlob(const std::vector<std::pair<std::string, std::string> > &entries, std::vector<char> &blob) {
+        // Lowercase and dedupe, last entry wins
+        std::unordered_map<std::string, std::string_view> unique;
+        unique.reserve(entries.size());
+        char key[kMaxKey + 8];
+        for (const auto &[word, replacement]: entries) {
+            if (word.empty() || word.size() > kMaxKey || replacement.size() > 0xFFFF) continue;
+            hashLowered(word, key);
+            unique[std::string(key, word.size())] = replacement;
+        }
+
+        struct Key {
+            uint64_t hash;
+            const std::string *word;
+            std::string_view value;
+        };
+        std::vector<Key> keys;
+        keys.reserve(unique.size());
+        size_t poolSize = 0;
+        for (const auto &[word, value]: unique) {
+            keys.push_back({hashLowered(word, key), &word, value});
+            poolSize += 3 + word.size() + value.size();
+        }
+        if (poolSize > 0xFFFFFFFFu) return false;
+
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.count = static_cast<uint32_t>(keys.size());
+        header.bucketCount = std::max<uint32_t>(1, header.count / 3);
+        header.poolSize = static_cast<uint32_t>(poolSize);
+
+        // A bucket that finds no 16-bit seed means the table is too full;
+        // retry with more slots.
+        for (uint32_t spare = 4; spare > 0; --spare) {
+            header.slotCount = std::max<uint32_t>(1, header.count + header.count / spare);
+            if (placeKeys(header, keys, blob)) return true;
+        }
+        return false;
+    }
+
+    template<class Key>
+    static bool placeKeys(const Header &header, const std::vector<Key> &keys, std::vector<char> &blob) {
+        std::vector<std::vector<const Key *> > buckets(header.bucketCount);
+        for (const Key &k: keys) buckets[reduce(k.hash, header.bucketCount)].push_back(&k);
+
+        blob.assign(poolOffset(header) + header.poolSize, '\0');
+        std::memcpy(blob.data(), &header, sizeof(header));
+        auto *bucketWords = reinterpret_cast<uint32_t *>(blob.data() + bucketsOffset());
+        auto *slots = reinterpret_cast<Slot *>(blob.data() + slotsOffset(header));
+        char *pool = blob.data() + poolOffset(header);
+
+        // Place the largest buckets first while the table is still empty
+        std::vector<uint32_t> order(header.bucketCount);
+        for (uint32_t b = 0; b < header.bucketCount; ++b) order[b] = b;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::vector<uint32_t> placed;
+        uint32_t poolUsed = 0;
+        for (uint32_t b: order) {
+            const std::vector<const Key *> &bucket = buckets[b];
+            if (bucket.empty()) break;
+            uint32_t seed = 0;
+            for (;; ++seed) {
+                if (seed > 0xFFFF) return false;
+                placed.clear();
+                bool ok = true;
+                for (const Key *k: bucket) {
+                    const uint32_t slot = reduce(mixSeed(k->hash, static_cast<uint16_t>(seed)), header.slotCount);
+                    if (slots[slot].tag || std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                        ok = false;
+                        break;
+                    }
+                    placed.push_back(slot);
+                }
+                if (ok) break;
+            }
+            bucketWords[b] = seed;
+            for (size_t i = 0; i < bucket.size(); ++i) {
+                const Key &k = *bucket[i];
+                bucketWords[b] |= filterBit(k.hash);
+                slots[placed[i]] = {tagOf(k.hash), poolUsed};
+                char *entry = pool + poolUsed;
+                entry[0] = static_cast<char>(k.word->size());
+                entry[1] = static_cast<char>(k.value.size() & 0xFF);
+                entry[2] = static_cast<char>(k.value.size() >> 8);
+                std::memcpy(entry + 3, k.word->data(), k.word->size());
+                std::memcpy(entry + 3 + k.word->size(), k.value.data(), k.value.size());
+                poolUsed += static_cast<uint32_t>(3 + k.word->size() + k.value.size());
+            }
+        }
+        return true;
+    }
+
+    // Checks the blob before trusting any offset in it.
+    bool attach(const char *data, size_t size) {
+        if (size < sizeof(Header)) return false;
+        const auto *header = reinterpret_cast<const Header *>(data);
+        if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->bucketCount == 0 ||
+            header->slotCount == 0 || poolOffset(*header) + header->poolSize != size)
+            return false;
+        const auto *slots = reinterpret_cast<const Slot *>(data + slotsOffset(*header));
+        const char *pool = data + poolOffset(*header);
+        for (uint32_t i = 0; i < header->slotCount; ++i) {
+            if (!slots[i].tag) continue;
+            const uint64_t offset = slots[i].offset;
+            if (offset + 3 > header->poolSize) return false;
+            const unsigned char *entry = reinterpret_cast<const unsigned char *>(pool + offset);
+            if (offset + 3 + entry[0] + (entry[1] | entry[2] << 8) > header->poolSize) return false;
+        }
+        header_ = header;
+        buckets_ = reinterpret_cast<const uint32_t *>(data + bucketsOffset());
+        slots_ = slots;
+        pool_ = data + poolOffset(*header);
+        data_ = data;
+        size_ = size;
+        return true;
+    }
 
-            std::string part = threeDigitsToWords(chunk);
-            if (!result.empty()) result += " ";
-            result += part;
-            if (!name.empty()) result += " " + name;
+    bool mapBlob(const std::string &path) {
+        unmap();
+#if !defined(_WIN32)
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st{};
+        void *p = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+            p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p != MAP_FAILED) {
+            mapped_ = p;
+            mappedSize_ = static_cast<size_t>(st.st_size);
+            if (attach(static_cast<const char *>(p), mappedSize_)) return true;
+            unmap();
+            return false;
         }
+#endif
+        // No mmap: read the blob into owned storage instead
+        std::ifstream in(path, std::ios::binary);
+        owned_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return attach(owned_.data(), owned_.size());
+    }
+
+    void unmap() {
+#if !defined(_WIN32)
+        if (mapped_) ::munmap(mapped_, mappedSize_);
+#endif
+        mapped_ = nullptr;
+        mappedSize_ = 0;
+        owned_.clear();
+        header_ = nullptr;
+        data_ = nullptr;
+        size_ = 0;
     }
 
-    return sign + result;
+    std::vector<char> owned_;
+    void *mapped_ = nullptr;
+    size_t mappedSize_ = 0;
+
+    const Header *header_ = nullptr;
+    const uint32_t *buckets_ = nullptr;
+    const Slot *slots_ = nullptr;
+    const char *pool_ = nullptr;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// The lexicon speakText, speakWord and speakMarkup apply; null disables it.
+static std::atomic<std::shared_ptr<const PronunciationLexicon> > gPronunciationLexicon;
+
+void setPronunciationLexicon(std::shared_ptr<const PronunciationLexicon> lexicon) {
+    gPronunciationLexicon.store(std::move(lexicon));
 }
 
-std::string lettersSeparated(const std::string &word, char sep = ' ', bool uppercase = true) {
-    std::string out;
-    out.reserve(word.size() * 3);
-    bool first = true;
-    for (unsigned char ch: word) {
-        if (std::isspace(ch)) continue;
-        if (!first) out += sep;
-        first = false;
-        out += static_cast<char>(uppercase ? std::toupper(ch) : ch);
+std::shared_ptr<const PronunciationLexicon> pronunciationLexicon() {
+    return gPronunciationLexicon.load();
+}
+
+// ---- Text normalization ----------------------------------------------------
+// normalizeForSpeech rewrites written text into the words an engine should
+// say: numbers, money, percentages, ordinals, times, dates and common
+// abbreviations. It is a single left-to-right pass over the input; anything it
+// does not recognise (including UTF-8 bytes) is copied through untouched.
+
+static bool isAsciiDigit(char c) { return c >= '0' && c <= '9'; }
+static bool isAsciiSpace(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+static bool isAsciiAlpha(char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; }
+static bool isAsciiAlnum(char c) { return isAsciiDigit(c) || isAsciiAlpha(c); }
+static char asciiLower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c; }
+
+static char charAt(std::string_view s, size_t i) { return i < s.size() ? s[i] : '\0'; }
+
+// Case-insensitive match of an ASCII keyword at s[i] that is not followed by
+// another letter.
+static bool matchWordAt(std::string_view s, size_t i, std::string_view word) {
+    if (s.size() - std::min(i, s.size()) < word.size()) return false;
+    for (size_t k = 0; k < word.size(); ++k)
+        if (asciiLower(s[i + k]) != word[k]) return false;
+    return !isAsciiAlpha(charAt(s, i + word.size()));
+}
+
+// Appends word with a separating space on either side where the neighbouring
+// text would otherwise run into it.
+static void appendSpaced(std::string &out, std::string_view word, char next) {
+    if (!out.empty() && isAsciiAlnum(out.back())) out += ' ';
+    out += word;
+    if (isAsciiAlnum(next)) out += ' ';
+}
+
+static void appendOrdinalWords(std::string &out, long long num) {
+    static constexpr std::pair<std::string_view, std::string_view> irregular[] = {
+        {"one", "first"}, {"two", "second"}, {"three", "third"}, {"five", "fifth"},
+        {"eight", "eighth"}, {"nine", "ninth"}, {"twelve", "twelfth"}
+    };
+    appendNumberWords(out, num);
+    // Only the last word changes: "twenty-one" -> "twenty-first"
+    size_t start = out.find_last_of(" -");
+    start = start == std::string::npos ? 0 : start + 1;
+    const std::string_view last(out.data() + start, out.size() - start);
+    for (auto [card, ord]: irregular) {
+        if (last == card) {
+            out.replace(start, out.size() - start, ord);
+            return;
+        }
+    }
+    if (out.back() == 'y') {
+        out.pop_back();
+        out += "ieth";
+    } else {
+        out += "th";
+    }
+}
+
+// Years are read in pairs ("nineteen eighty-four", "eighteen oh five") except
+// round thousands and 2001-2009, which read as cardinals.
+static void appendYearWords(std::string &out, int year) {
+    if (year < 1100 || year > 9999 || year % 1000 == 0 || (year >= 2000 && year < 2010)) {
+        appendNumberWords(out, year);
+        return;
+    }
+    appendNumberWords(out, year / 100);
+    out += ' ';
+    const int lo = year % 100;
+    if (lo == 0) {
+        out += "hundred";
+    } else {
+        if (lo < 10) out += "oh ";
+        appendNumberWords(out, lo);
     }
-    return out;
 }
 
-void speakSpelled(const std::string &word) {
-    std::string spelled = lettersSeparated(word, ',', true);
+static void appendDateWords(std::string &out, int month, int day, int year) {
+    static constexpr std::string_view months[] = {
+        "January", "February", "March", "April", "May", "June",
+        "July", "August", "September", "October", "November", "December"
+    };
+    out += months[month - 1];
+    out += ' ';
+    appendOrdinalWords(out, day);
+    out += ", ";
+    appendYearWords(out, year);
+}
 
-    for (size_t i = 1; i < spelled.size(); ++i) {
-        if (spelled[i - 1] == ',') spelled.insert(i++, " ");
+// Reads up to maxDigits digits at s[i]; returns the count read (0 on none).
+static size_t readDigits(std::string_view s, size_t i, size_t maxDigits, int &value) {
+    size_t n = 0;
+    value = 0;
+    while (n < maxDigits && isAsciiDigit(charAt(s, i + n))) {
+        value = value * 10 + (s[i + n] - '0');
+        ++n;
     }
+    return n;
+}
 
-    speakText(spelled);
+static bool isValidDate(int month, int day, int year) {
+    static constexpr int days[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12 || day < 1 || day > days[month - 1]) return false;
+    const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    return month != 2 || day < 29 || leap;
 }
 
-static std::string escapeForShellSingleQuotes(const std::string &s) {
-    std::string out;
-    out.reserve(s.size() + 8);
-    for (char c: s) {
-        if (c == '\'') out += "'\"'\"'";
-        else out += c;
+// ISO "YYYY-MM-DD", US "M/D/YYYY" and dotted "D.M.YYYY". Returns the index
+// past the date, or 0 when s[i] does not start one. Something shaped like a
+// date that is not a real one ("2024-13-01") is copied through as written.
+static size_t verbalizeDate(std::string_view s, size_t i, std::string &out) {
+    int a, b, c;
+    size_t n = readDigits(s, i, 5, a);
+    if (n == 4 && charAt(s, i + 4) == '-') {
+        if (readDigits(s, i + 5, 3, b) != 2 || charAt(s, i + 7) != '-') return 0;
+        if (readDigits(s, i + 8, 3, c) != 2) return 0;
+        if (isValidDate(b, c, a)) appendDateWords(out, b, c, a);
+        else out.append(s.substr(i, 10));
+        return i + 10;
     }
-    return out;
+    const char sep = charAt(s, i + n);
+    if (n < 1 || n > 2 || (sep != '/' && sep != '.')) return 0;
+    size_t j = i + n + 1;
+    size_t m = readDigits(s, j, 3, b);
+    if (m < 1 || m > 2) return 0;
+    j += m;
+    // Without a year "1/2" is more likely a fraction (and "1.5" a decimal)
+    if (charAt(s, j) != sep || readDigits(s, j + 1, 5, c) != 4) return 0;
+    if (sep == '.') std::swap(a, b); // day first
+    if (isValidDate(a, b, c)) appendDateWords(out, a, b, c);
+    else out.append(s.substr(i, j + 5 - i));
+    return j + 5;
 }
 
-static std::string escapeForPowerShellSingleQuotes(const std::string &s) {
-    // In PowerShell single-quoted strings, escape ' by doubling it
-    std::string out;
-    out.reserve(s.size() + 8);
-    for (char c: s) {
-        if (c == '\'') out += "''";
-        else out += c;
+// Reads every digit in s on its own ("0800" -> "zero eight zero zero"),
+// skipping separators.
+static void appendDigitWords(std::string &out, std::string_view s) {
+    bool first = true;
+    for (char d: s) {
+        if (!isAsciiDigit(d)) continue;
+        if (!first) out += ' ';
+        appendNumberWords(out, d - '0');
+        first = false;
     }
-    return out;
 }
 
-void speakText(const std::string &text) {
-#if defined(_WIN32)
-    std::string t = escapeForPowerShellSingleQuotes(text);
-    std::string cmd = "powershell -NoProfile -Command \"$v=New-Object -ComObject SAPI.SpVoice; $null = $v.Speak('" + t +
-                      "');\"";
-    std::system(cmd.c_str());
-#elif defined(__APPLE__)
-    std::string t = escapeForShellSingleQuotes(text);
-    std::string cmd = "say '" + t + "'";
-    std::system(cmd.c_str());
-#else
-    std::string t = escapeForShellSingleQuotes(text);
-    std::string cmd = "espeak '" + t + "'";
-    std::system(cmd.c_str());
-#endif
+// Phone-shaped "NNN-NNNN" or "NNN-NNN-NNNN", optionally after "1-", read
+// digit by digit. Returns the index past it, or 0.
+static size_t verbalizePhone(std::string_view s, size_t i, std::string &out) {
+    auto group = [&](size_t at, size_t len) {
+        for (size_t k = 0; k < len; ++k)
+            if (!isAsciiDigit(charAt(s, at + k))) return false;
+        return charAt(s, at + len) == '-';
+    };
+    size_t j = i;
+    if (charAt(s, j) == '1' && group(j, 1) && group(j + 2, 3)) j += 2;
+    if (!group(j, 3)) return 0;
+    j += 4;
+    if (group(j, 3)) j += 4;
+    for (size_t k = 0; k < 4; ++k)
+        if (!isAsciiDigit(charAt(s, j + k))) return 0;
+    j += 4;
+    if (isAsciiAlnum(charAt(s, j)) || (charAt(s, j) == '-' && isAsciiDigit(charAt(s, j + 1)))) return 0;
+    appendDigitWords(out, s.substr(i, j - i));
+    return j;
 }
 
-void speakNumber(long long num) {
-    speakText(numberToWords(num));
+// "am", "pm", "a.m." or "p.m." after an optional space. Returns the index past
+// the marker, or 0.
+static size_t matchMeridiem(std::string_view s, size_t i, char &which) {
+    if (charAt(s, i) == ' ') ++i;
+    const char c = asciiLower(charAt(s, i));
+    if (c != 'a' && c != 'p') return 0;
+    which = c;
+    if (matchWordAt(s, i + 1, "m")) return i + 2;
+    if (charAt(s, i + 1) == '.' && asciiLower(charAt(s, i + 2)) == 'm' && charAt(s, i + 3) == '.')
+        return i + 4;
+    return 0;
 }
 
-void speakWord(const std::string &text) {
-    speakText(text);
+static size_t appendMeridiem(std::string_view s, size_t i, std::string &out) {
+    char which;
+    const size_t end = matchMeridiem(s, i, which);
+    if (!end) return i;
+    out += which == 'a' ? " a m" : " p m";
+    return end;
 }
 
-void drawSquare(int n, char ch = '#', bool filled = true) {
-    if (n <= 0) return;
-    for (int r = 0; r < n; ++r) {
-        for (int c = 0; c < n; ++c) {
-            if (filled || r == 0 || r == n - 1 || c == 0 || c == n - 1)
-                std::cout << ch;
-            else
-                std::cout << ' ';
-        }
-        std::cout << '\n';
+// "H:MM" with an optional am/pm. Returns the index past the time, or 0. A
+// 12-hour time with an hour outside 1-12 ("13:05 pm") is copied through as
+// written; any other out-of-range one ("25:00") is read digit by digit.
+static size_t verbalizeTime(std::string_view s, size_t i, std::string &out) {
+    int hour, minute;
+    const size_t n = readDigits(s, i, 3, hour);
+    if (n < 1 || n > 2 || charAt(s, i + n) != ':') return 0;
+    if (readDigits(s, i + n + 1, 3, minute) != 2) return 0;
+    size_t j = i + n + 3;
+    if (hour > 24 || minute > 59) {
+        appendDigitWords(out, s.substr(i, j - i));
+        return j;
+    }
+    char which;
+    const size_t meridiemEnd = matchMeridiem(s, j, which);
+    const bool meridiem = meridiemEnd != 0;
+    if (meridiem && (hour < 1 || hour > 12)) {
+        out.append(s.substr(i, meridiemEnd - i));
+        return meridiemEnd;
     }
+
+    appendNumberWords(out, hour);
+    if (minute) {
+        out += ' ';
+        if (minute < 10) out += "oh ";
+        appendNumberWords(out, minute);
+    } else if (!meridiem) {
+        out += " o'clock";
+    }
+    return appendMeridiem(s, j, out);
 }
 
-void renderAsciiArt(const std::vector<std::string>& pattern,
-                    int scaleX = 1, int scaleY = 1,
-                    char on = '#', char off = ' ')
-{
-    if (pattern.empty() || scaleX < 1 || scaleY < 1) return;
+// Numbers: optional sign and '$', comma thousands separators, decimals and a
+// '%' or ordinal suffix; "N-M" reads as a range. Long digit runs, ones with a
+// leading zero or a malformed grouping (codes, phone numbers) are read digit
+// by digit.
+static size_t verbalizeNumber(std::string_view s, size_t i, std::string &out) {
+    if (!out.empty() && (isAsciiAlnum(out.back()) || out.back() == '+')) out += ' ';
+
+    bool negative = false, money = false;
+    if (s[i] == '-') {
+        negative = true;
+        ++i;
+    }
+    if (s[i] == '$') {
+        money = true;
+        ++i;
+    }
+
+    if (!negative && !money) {
+        if (size_t end = verbalizeDate(s, i, out)) return end;
+        if (size_t end = verbalizeTime(s, i, out)) return end;
+        if (size_t end = verbalizePhone(s, i, out)) return end;
+    }
+
+    // Integer part, dropping well-formed thousands separators
+    std::string digits;
+    size_t j = i;
+    while (isAsciiDigit(charAt(s, j))) digits += s[j++];
+    const size_t leading = digits.size();
+    while (charAt(s, j) == ',' && isAsciiDigit(charAt(s, j + 1)) && isAsciiDigit(charAt(s, j + 2)) &&
+           isAsciiDigit(charAt(s, j + 3)) && !isAsciiDigit(charAt(s, j + 4))) {
+        digits.append(s.substr(j + 1, 3));
+        j += 4;
+    }
+    // "1,00" or "1234,567": not a grouping, so the separators are dropped
+    if ((charAt(s, j) == ',' && isAsciiDigit(charAt(s, j + 1))) || (j > i + leading && leading > 3)) {
+        while (isAsciiDigit(charAt(s, j)) || (charAt(s, j) == ',' && isAsciiDigit(charAt(s, j + 1)))) ++j;
+        if (negative) out += "minus ";
+        appendDigitWords(out, s.substr(i, j - i));
+        if (isAsciiAlpha(charAt(s, j))) out += ' ';
+        return j;
+    }
+    size_t fracBegin = j, fracEnd = j;
+    if (charAt(s, j) == '.' && isAsciiDigit(charAt(s, j + 1))) {
+        fracBegin = ++j;
+        while (isAsciiDigit(charAt(s, j))) ++j;
+        fracEnd = j;
+    }
+    const std::string_view frac = s.substr(fracBegin, fracEnd - fracBegin);
+
+    if (negative) out += "minus ";
 
-    const size_t rows = pattern.size();
-    size_t cols = 0;
-    for (const auto& row : pattern) cols = std::max(cols, row.size());
+    if (digits.size() > 18 || (digits.size() > 1 && digits[0] == '0' && !money)) {
+        appendDigitWords(out, digits);
+        if (isAsciiAlpha(charAt(s, j))) out += ' ';
+        return j;
+    }
+
+    const long long value = std::stoll(digits);
 
-    for (size_t r = 0; r < rows; ++r) {
-        for (int sy = 0; sy < scaleY; ++sy) {
-            for (size_t c = 0; c < cols; ++c) {
-                const bool bit = (c < pattern[r].size() && pattern[r][c] != ' ');
-                const char ch = bit ? on : off;
-                for (int sx = 0; sx < scaleX; ++sx)
-                    std::cout << ch;
+    if (money) {
+        int cents = 0;
+        if (!frac.empty()) cents = (frac[0] - '0') * 10 + (frac.size() > 1 ? frac[1] - '0' : 0);
+        if (value || !cents) {
+            appendNumberWords(out, value);
+            out += value == 1 ? " dollar" : " dollars";
+            if (cents) out += " and ";
+        }
+        if (cents) {
+            appendNumberWords(out, cents);
+            out += cents == 1 ? " cent" : " cents";
+        }
+    } else if (frac.empty() && digits.size() == 4 && value >= 1000 && matchWordAt(s, j, "s")) {
+        // Decades and centuries: "1980s" -> "nineteen eighties"
+        appendYearWords(out, static_cast<int>(value));
+        if (out.back() == 'y') {
+            out.pop_back();
+            out += "ies";
+        } else {
+            out += 's';
+        }
+        ++j;
+    } else if (frac.empty() && (matchWordAt(s, j, "st") || matchWordAt(s, j, "nd") ||
+                                matchWordAt(s, j, "rd") || matchWordAt(s, j, "th"))) {
+        appendOrdinalWords(out, value);
+        j += 2;
+    } else {
+        appendNumberWords(out, value);
+        if (!frac.empty()) {
+            out += " point";
+            for (char d: frac) {
+                out += ' ';
+                appendNumberWords(out, d - '0');
             }
-            std::cout << '\n';
+        }
+        if (charAt(s, j) == '%') {
+            out += " percent";
+            ++j;
+        } else if (charAt(s, j) == '-' && isAsciiDigit(charAt(s, j + 1))) {
+            // "1990-1995", "10-20%"
+            out += " to ";
+            return verbalizeNumber(s, j + 1, out);
+        } else if (frac.empty() && value >= 1 && value <= 12) {
+            // A bare "am" followed by another word is the verb: "5 am I not"
+            char which;
+            const size_t end = matchMeridiem(s, j, which);
+            const bool bareAm = end && which == 'a' && s[end - 1] != '.';
+            if (!bareAm || !isAsciiAlpha(charAt(s, end + (charAt(s, end) == ' '))))
+                j = appendMeridiem(s, j, out);
         }
     }
+
+    if (isAsciiAlpha(charAt(s, j))) out += ' ';
+    return j;
 }
 
-void drawCircle(int radius, char ch = 'o', bool filled = false) {
-    if (radius <= 0) return;
+// Dotted abbreviations, keyed in lower case with their dots. Kept sorted for
+// the binary search in expandAbbreviation.
+static constexpr std::pair<std::string_view, std::string_view> kAbbreviations[] = {
+    {"approx.", "approximately"}, {"apr.", "April"}, {"aug.", "August"}, {"ave.", "Avenue"},
+    {"blvd.", "Boulevard"}, {"capt.", "Captain"}, {"co.", "Company"}, {"dec.", "December"},
+    {"dept.", "Department"}, {"dr.", "Doctor"}, {"e.g.", "for example"}, {"etc.", "et cetera"},
+    {"feb.", "February"}, {"ft.", "feet"}, {"gen.", "General"}, {"i.e.", "that is"},
+    {"inc.", "Incorporated"}, {"jan.", "January"}, {"jr.", "Junior"}, {"lt.", "Lieutenant"},
+    {"ltd.", "Limited"}, {"mr.", "Mister"}, {"mrs.", "Missus"}, {"ms.", "Miz"},
+    {"mt.", "Mount"}, {"no.", "number"}, {"nov.", "November"}, {"oct.", "October"},
+    {"prof.", "Professor"}, {"rd.", "Road"}, {"sept.", "September"}, {"sgt.", "Sergeant"},
+    {"sr.", "Senior"}, {"st.", "Street"}, {"vs.", "versus"}
+};
+
+static_assert(std::is_sorted(std::begin(kAbbreviations), std::end(kAbbreviations),
+                             [](const auto &a, const auto &b) { return a.first < b.first; }));
+
+// Copies the word at s[i], expanding it when it is a known abbreviation.
+static size_t expandAbbreviation(std::string_view s, size_t i, std::string &out) {
+    size_t end = i;
+    while (isAsciiAlpha(charAt(s, end))) ++end;
+
+    // Candidate spans "word." and, for a single letter, "x.y." forms such as
+    // "e.g."; a letter after "Mr." starts the next word instead
+    size_t candidate = end;
+    if (charAt(s, end) == '.') {
+        candidate = end + 1;
+        if (end - i == 1)
+            while (isAsciiAlpha(charAt(s, candidate)) && charAt(s, candidate + 1) == '.') candidate += 2;
+    }
+
+    char key[16];
+    const size_t len = candidate - i;
+    if (candidate > end && len <= sizeof(key)) {
+        for (size_t k = 0; k < len; ++k) key[k] = asciiLower(s[i + k]);
+        const std::string_view lookup(key, len);
+        auto it = std::lower_bound(std::begin(kAbbreviations), std::end(kAbbreviations), lookup,
+                                   [](const auto &entry, std::string_view k) { return entry.first < k; });
+        // "No." only means "number" in front of one
+        const bool applies = lookup != "no." || isAsciiDigit(charAt(s, candidate + (charAt(s, candidate) == ' ')));
+        if (it != std::end(kAbbreviations) && it->first == lookup && applies) {
+            out += it->second;
+            // "Mr.Smith" -> "Mister Smith"
+            if (isAsciiAlnum(charAt(s, candidate))) out += ' ';
+            return candidate;
+        }
+    }
+    out.append(s.substr(i, end - i));
+    return end;
+}
 
-    // Characters are roughly twice as tall as they are wide in many consoles,
-    // so scale x to make the circle look rounder.
-    const double xScale = 2.0;
-    const int height = 2 * radius + 1;
-    const int width = static_cast<int>(2 * radius * xScale) + 1;
+// A '+' reads as "plus" between spaces or digits ("3 + 4", "5+ years") or in
+// front of a number ("+1 555"), but not in names like "C++" or "g++".
+static bool isPlusSign(std::string_view s, size_t i) {
+    const char prev = i ? s[i - 1] : ' ';
+    const char next = charAt(s, i + 1);
+    const bool spaceOrDigitBefore = isAsciiSpace(prev) || isAsciiDigit(prev);
+    const bool spaceOrDigitAfter = isAsciiSpace(next) || isAsciiDigit(next);
+    return (spaceOrDigitBefore && spaceOrDigitAfter) || (!isAsciiAlnum(prev) && prev != '+' && isAsciiDigit(next));
+}
 
-    const double r = static_cast<double>(radius);
-    const double r2 = r * r;
-    const double thickness = 0.85; // for outline: smaller -> thinner line
+// Rewrites in into speakable words, replacing the contents of out. Callers on
+// a hot path keep out around between calls so its capacity is reused. Words
+// found in lexicon are replaced by its respelling before any other rule.
+void normalizeForSpeech(std::string_view in, std::string &out, const PronunciationLexicon *lexicon = nullptr) {
+    out.clear();
+    out.reserve(in.size() + in.size() / 2);
 
-    for (int y = 0; y < height; ++y) {
-        double dy = y - radius;
-        for (int x = 0; x < width; ++x) {
-            double dx = (x - (width - 1) / 2.0) / xScale;
-            double dist2 = dx * dx + dy * dy;
+    size_t i = 0;
+    size_t lexiconChecked = 0; // tokens before this were already looked up
+    while (i < in.size()) {
+        const char c = in[i];
+        const char next = charAt(in, i + 1);
+        const bool wordStart = i == 0 || !isAsciiAlnum(in[i - 1]);
 
-            bool pixel = filled
-                             ? (dist2 <= r2 + 0.25) // small fudge to avoid gaps
-                             : (std::abs(dist2 - r2) <= thickness);
+        if (lexicon && i >= lexiconChecked && (isAsciiAlnum(c) || (c & 0x80))) {
+            size_t end = i;
+            while (end < in.size() && (isAsciiAlnum(in[end]) || (in[end] & 0x80))) ++end;
+            lexiconChecked = end;
+            if (const std::string_view respelled = lexicon->lookup(in.substr(i, end - i)); !respelled.empty()) {
+                if (!out.empty() && isAsciiAlnum(out.back())) out += ' ';
+                out += respelled;
+                i = end;
+                continue;
+            }
+        }
 
-            std::cout << (pixel ? ch : ' ');
+        if (isAsciiDigit(c) || (c == '$' && isAsciiDigit(next)) ||
+            (c == '-' && wordStart && (isAsciiDigit(next) || (next == '$' && isAsciiDigit(charAt(in, i + 2)))))) {
+            i = verbalizeNumber(in, i, out);
+        } else if (isAsciiAlpha(c) && wordStart) {
+            i = expandAbbreviation(in, i, out);
+        } else if (c == '&') {
+            appendSpaced(out, "and", next);
+            ++i;
+        } else if (c == '@') {
+            appendSpaced(out, "at", next);
+            ++i;
+        } else if (c == '+' && isPlusSign(in, i)) {
+            appendSpaced(out, "plus", next);
+            ++i;
+        } else if (c == '#' && isAsciiDigit(next)) {
+            appendSpaced(out, "number", next);
+            ++i;
+        } else {
+            out += c;
+            ++i;
         }
-        std::cout << '\n';
     }
 }
 
-int main() {
-    auto lang = "C++";
-    std::cout << "Hello and welcome to " << lang << "!\n";
+std::string normalizeForSpeech(std::string_view in) {
+    std::string out;
+    normalizeForSpeech(in, out);
+    return out;
+}
 
-    for (int i = 1; i <= 1; i++) {
-        std::cout << i << " -> " << numberToWords(i) << '\n';
-        speakText("Counting a number:");
-        speakNumber(i);
+// ---- Spelling -----------------------------------------------------------------
+// lettersSeparated works on user-perceived characters: pure-ASCII input stays on
+// a byte loop, anything else is decoded as UTF-8 and split into grapheme
+// clusters (a base codepoint plus its combining marks, variation selectors and
+// ZWJ-joined followers) so "João" spells as J, O, Ã, O rather than as bytes.
+
+// True when every byte is below 0x80.
+static bool isAsciiOnly(const char *p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        if (_mm_movemask_epi8(v)) return false;
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        if (w & 0x8080808080808080ULL) return false;
     }
+#endif
+    for (; i < n; ++i)
+        if (static_cast<unsigned char>(p[i]) & 0x80) return false;
+    return true;
+}
 
-    int n = 300;
-    int d = 1408;
 
-    std::cout << n << " -> " << numberToWords(n) << '\n';
-    std::cout << d << " -> " << numberToWords(d) << '\n';
+// Decodes one codepoint at s[i] into cp and returns its byte length. Malformed
+// or overlong sequences decode as a single byte with cp = 0xFFFD.
+static size_t decodeUtf8(std::string_view s, size_t i, char32_t &cp) {
+    const unsigned char b0 = s[i];
+    if (b0 < 0x80) {
+        cp = b0;
+        return 1;
+    }
+    size_t len;
+    char32_t min;
+    if ((b0 & 0xE0) == 0xC0) {
+        len = 2, cp = b0 & 0x1F, min = 0x80;
+    } else if ((b0 & 0xF0) == 0xE0) {
+        len = 3, cp = b0 & 0x0F, min = 0x800;
+    } else if ((b0 & 0xF8) == 0xF0) {
+        len = 4, cp = b0 & 0x07, min = 0x10000;
+    } else {
+        cp = 0xFFFD;
+        return 1;
+    }
+    if (i + len > s.size()) {
+        cp = 0xFFFD;
+        return 1;
+    }
+    for (size_t k = 1; k < len; ++k) {
+        const unsigned char b = s[i + k];
+        if ((b & 0xC0) != 0x80) {
+            cp = 0xFFFD;
+            return 1;
+        }
+        cp = (cp << 6) | (b & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+        cp = 0xFFFD;
+        return 1;
+    }
+    return len;
+}
+
+// Encodes cp into buf and returns the byte count.
+static size_t encodeUtf8(char32_t cp, char *buf) {
+    if (cp < 0x80) {
+        buf[0] = static_cast<char>(cp);
+        return 1;
+    }
+    if (cp < 0x800) {
+        buf[0] = static_cast<char>(0xC0 | (cp >> 6));
+        buf[1] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        buf[0] = static_cast<char>(0xE0 | (cp >> 12));
+        buf[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    buf[0] = static_cast<char>(0xF0 | (cp >> 18));
+    buf[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    buf[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    buf[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 4;
+}
 
-    speakNumber(n);
-    speakNumber(d);
+// Codepoints that attach to the preceding one instead of starting a cluster.
+static bool isClusterExtender(char32_t cp) {
+    return (cp >= 0x0300 && cp <= 0x036F) ||   // combining diacritics
+           (cp >= 0x1AB0 && cp <= 0x1AFF) ||   // ... extended
+           (cp >= 0x1DC0 && cp <= 0x1DFF) ||   // ... supplement
+           (cp >= 0x20D0 && cp <= 0x20FF) ||   // ... for symbols
+           (cp >= 0xFE20 && cp <= 0xFE2F) ||   // combining half marks
+           (cp >= 0xFE00 && cp <= 0xFE0F) ||   // variation selectors
+           (cp >= 0xE0100 && cp <= 0xE01EF) || // ... supplement
+           (cp >= 0x1F3FB && cp <= 0x1F3FF) || // emoji skin tones
+           cp == 0x200D;                       // zero width joiner
+}
 
-    std::string w = "Morizo";
-    std::cout << w << " -> " << lettersSeparated(w, ' ', true) << '\n';
-    speakSpelled(w);
-    speakWord(w);
+static bool isUnicodeSpace(char32_t cp) {
+    return (cp < 0x80 && isAsciiSpace(static_cast<unsigned char>(cp))) || cp == 0x00A0 || cp == 0x1680 ||
+           (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029 || cp == 0x202F ||
+           cp == 0x205F || cp == 0x3000;
+}
 
-    drawSquare(5);
-    std::cout << '\n';
-    drawSquare(6, '*', false);
+// Lower-to-upper mappings for Latin-1, Latin Extended-A and Latin Extended
+// Additional. A range with step 2 maps every other codepoint starting at lo.
+struct CaseRange {
+    char32_t lo, hi;
+    int16_t delta;
+    uint8_t step;
+};
 
-    std::cout << "Outline circle (r=8):\n";
-    drawCircle(8, '*', false);
+static constexpr CaseRange kUpperCaseRanges[] = {
+    {0x00E0, 0x00F6, -32, 1}, {0x00F8, 0x00FE, -32, 1}, {0x00FF, 0x00FF, 0x0178 - 0x00FF, 1},
+    {0x0101, 0x012F, -1, 2}, {0x0131, 0x0131, 'I' - 0x0131, 1}, {0x0133, 0x0137, -1, 2},
+    {0x013A, 0x0148, -1, 2}, {0x014B, 0x0177, -1, 2}, {0x017A, 0x017E, -1, 2},
+    {0x017F, 0x017F, 'S' - 0x017F, 1}, {0x1E01, 0x1E95, -1, 2}, {0x1EA1, 0x1EFF, -1, 2}
+};
 
-    std::cout << "\nFilled circle (r=6):\n";
-    drawCircle(6, '#', true);
+static char32_t toUpperLatin(char32_t cp) {
+    if (cp < 0x80) return (cp >= 'a' && cp <= 'z') ? cp - 32 : cp;
+    for (const CaseRange &r: kUpperCaseRanges) {
+        if (cp < r.lo) break;
+        if (cp <= r.hi && (r.step == 1 || (cp - r.lo) % 2 == 0)) return cp + r.delta;
+    }
+    return cp;
+}
+
+// Index past the cluster whose base ends at i: combining marks, and whatever
+// a ZWJ glues on.
+static size_t clusterEnd(std::string_view s, size_t i) {
+    while (i < s.size()) {
+        char32_t cp;
+        const size_t len = decodeUtf8(s, i, cp);
+        if (!isClusterExtender(cp)) break;
+        i += len;
+        if (cp == 0x200D && i < s.size()) i += decodeUtf8(s, i, cp);
+    }
+    return i;
+}
 
+// ASCII fast path. Output is sized for the worst case up front and trimmed at
+// the end. With a one-byte separator, runs of 16 letters are uppercased and
+// interleaved with the separator in registers (unpack sep/char pairs); blocks
+// containing whitespace, the leading letter and the tail go through the
+// scalar loop, so the result is byte-for-byte the same.
+static void appendAsciiLettersSeparated(std::string &out, std::string_view word, std::string_view sep,
+                                        bool uppercase) {
+    const size_t start = out.size();
+    out.resize(start + word.size() * (1 + sep.size()));
+    char *dst = out.data() + start;
+    bool first = true;
 
-    std::vector<std::string> heart = {
-        "  **   **  ",
-        " **** **** ",
-        "***********",
-        " ********* ",
-        "  *******  ",
-        "   *****   ",
-        "    ***    ",
-        "     *     "
+    auto scalar = [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            const unsigned char ch = word[i];
+            if (isAsciiSpace(ch)) continue;
+            if (!first) {
+                std::memcpy(dst, sep.data(), sep.size());
+                dst += sep.size();
+            }
+            first = false;
+            *dst++ = static_cast<char>(uppercase && ch >= 'a' && ch <= 'z' ? ch - 32 : ch);
+        }
     };
 
-    std::cout << "Heart x1:\n";
-    renderAsciiArt(heart, 1, 1, '@', ' ');
+    size_t i = 0;
+    while (i < word.size() && first) scalar(i, i + 1), ++i;
 
-    std::cout << "\nHeart x2 (scaled):\n";
-    renderAsciiArt(heart, 2, 2, '*', ' ');
+#if defined(__SSE2__)
+    if (sep.size() == 1) {
+        const __m128i sepv = _mm_set1_epi8(sep[0]);
+        const __m128i caseBit = _mm_set1_epi8(uppercase ? 0x20 : 0);
+        const __m128i beforeA = _mm_set1_epi8('a' - 1), afterZ = _mm_set1_epi8('z' + 1);
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i beforeTab = _mm_set1_epi8('\t' - 1), afterCr = _mm_set1_epi8('\r' + 1);
+        for (; i + 16 <= word.size(); i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(word.data() + i));
+            const __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                            _mm_and_si128(_mm_cmpgt_epi8(v, beforeTab),
+                                                          _mm_cmplt_epi8(v, afterCr)));
+            if (_mm_movemask_epi8(ws)) {
+                scalar(i, i + 16);
+                continue;
+            }
+            const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, beforeA), _mm_cmplt_epi8(v, afterZ));
+            v = _mm_sub_epi8(v, _mm_and_si128(lower, caseBit));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi8(sepv, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_unpackhi_epi8(sepv, v));
+            dst += 32;
+        }
+    }
+#endif
+    scalar(i, word.size());
+    out.resize(dst - out.data());
+}
 
+static void appendLettersSeparated(std::string &out, std::string_view word, std::string_view sep,
+                                   bool uppercase) {
+    bool first = true;
+    if (isAsciiOnly(word.data(), word.size())) {
+        appendAsciiLettersSeparated(out, word, sep, uppercase);
+        return;
+    }
 
-    std::vector<std::string> smiley = {
-        "  *****  ",
-        " *     * ",
-        "*  * *  *",
-        "*       *",
-        "*  ---  *",
-        " *     * ",
-        "  *****  "
-    };
+    out.reserve(out.size() + word.size() * (1 + sep.size()) + 8);
+    size_t i = 0;
+    while (i < word.size()) {
+        char32_t base;
+        const size_t baseLen = decodeUtf8(word, i, base);
+        if (isUnicodeSpace(base)) {
+            i += baseLen;
+            continue;
+        }
+
+        const size_t end = clusterEnd(word, i + baseLen);
+        if (!first) out += sep;
+        first = false;
+        if (uppercase && base != 0xFFFD) {
+            char buf[4];
+            out.append(buf, encodeUtf8(toUpperLatin(base), buf));
+        } else {
+            out.append(word.substr(i, baseLen));
+        }
+        out.append(word.substr(i + baseLen, end - i - baseLen));
+        i = end;
+    }
+}
+
+std::string lettersSeparated(const std::string &word, char sep = ' ', bool uppercase = true) {
+    std::string out;
+    appendLettersSeparated(out, word, std::string_view(&sep, 1), uppercase);
+    return out;
+}
+
+// XML escaping for speech markup; spelled output is written as markup too.
+static std::string_view xmlEntityFor(char c) {
+    switch (c) {
+        case '&': return "&amp;";
+        case '<': return "&lt;";
+        case '>': return "&gt;";
+        case '"': return "&quot;";
+        case '\'': return "&apos;";
+        default: return {};
+    }
+}
+
+static void appendXmlEscaped(std::string &out, std::string_view text) {
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const std::string_view entity = xmlEntityFor(text[i]);
+        if (entity.empty()) continue;
+        out.append(text.substr(run, i - run));
+        out += entity;
+        run = i + 1;
+    }
+    out.append(text.substr(run));
+}
+
+static void appendXmlUnescaped(std::string &out, std::string_view text) {
+    static constexpr std::pair<std::string_view, char> entities[] = {
+        {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}
+    };
+    size_t i = 0;
+    while (i < text.size()) {
+        const size_t amp = text.find('&', i);
+        out.append(text.substr(i, amp == std::string_view::npos ? amp : amp - i));
+        if (amp == std::string_view::npos) break;
+        i = amp + 1;
+        char decoded = '&';
+        for (auto [entity, ch]: entities) {
+            if (text.substr(amp, entity.size()) == entity) {
+                decoded = ch;
+                i = amp + entity.size();
+                break;
+            }
+        }
+        out += decoded;
+    }
+}
+
+// Spelling modes for readback:
+//   Letters  "M, O, R"
+//   Nato     "Mike Oscar Romeo"
+//   AsIn     "M as in Mike, O as in Oscar, R as in Romeo"
+// Digits are read as words in the phonetic modes. Spaces and dashes in the
+// input start a new group; with groupSize > 0 the characters are regrouped
+// into fixed-size runs instead ("ABC123" -> "ABC. 123" for 3).
+enum class Spelling { Letters, Nato, AsIn };
+
+static constexpr std::string_view kNatoAlphabet[26] = {
+    "Alpha", "Bravo", "Charlie", "Delta", "Echo", "Foxtrot", "Golf", "Hotel", "India",
+    "Juliet", "Kilo", "Lima", "Mike", "November", "Oscar", "Papa", "Quebec", "Romeo",
+    "Sierra", "Tango", "Uniform", "Victor", "Whiskey", "X-ray", "Yankee", "Zulu"
+};
+
+static constexpr std::string_view kSpellItemBreak = "<break time=\"250ms\"/>";
+static constexpr std::string_view kSpellGroupBreak = "<break time=\"600ms\"/>";
+
+// Writes the spelling of word to dst, or only measures it when dst is null.
+// Returns the length either way. With markup set, items are separated by
+// <break> elements instead of punctuation and the text is escaped.
+static size_t spellInto(char *dst, std::string_view word, Spelling mode, int groupSize, bool markup = false) {
+    static const std::array<std::string, 10> digitWords = [] {
+        std::array<std::string, 10> words;
+        for (int d = 0; d < 10; ++d) words[d] = numberToWords(d);
+        return words;
+    }();
+
+    size_t len = 0;
+    auto put = [&](std::string_view piece) {
+        if (dst) std::memcpy(dst + len, piece.data(), piece.size());
+        len += piece.size();
+    };
+    auto putText = [&](std::string_view piece) {
+        if (!markup) return put(piece);
+        for (char c: piece) {
+            if (const std::string_view entity = xmlEntityFor(c); !entity.empty()) put(entity);
+            else put(std::string_view(&c, 1));
+        }
+    };
+
+    const std::string_view itemSep = markup ? kSpellItemBreak : mode == Spelling::Nato ? " " : ", ";
+    const std::string_view groupSep = markup ? kSpellGroupBreak : ". ";
+    int inGroup = 0;
+    bool breakPending = false;
+    size_t i = 0;
+    while (i < word.size()) {
+        char32_t base;
+        const size_t baseLen = decodeUtf8(word, i, base);
+        if (isUnicodeSpace(base) || base == '-') {
+            breakPending = inGroup > 0 && groupSize <= 0;
+            i += baseLen;
+            continue;
+        }
+        const size_t end = clusterEnd(word, i + baseLen);
+
+        if (inGroup > 0 && (breakPending || inGroup == groupSize)) {
+            put(groupSep);
+            inGroup = 0;
+        } else if (inGroup > 0) {
+            put(itemSep);
+        }
+        breakPending = false;
+        ++inGroup;
+
+        const char32_t upper = base == 0xFFFD ? base : toUpperLatin(base);
+        char buf[4];
+        const std::string_view glyph = base == 0xFFFD ? word.substr(i, baseLen)
+                                                      : std::string_view(buf, encodeUtf8(upper, buf));
+        const std::string_view marks = word.substr(i + baseLen, end - i - baseLen);
+
+        if (mode != Spelling::Letters && upper >= '0' && upper <= '9') {
+            put(digitWords[upper - '0']);
+        } else if (mode == Spelling::Letters || upper < 'A' || upper > 'Z' || !marks.empty()) {
+            putText(glyph);
+            put(marks);
+        } else if (mode == Spelling::Nato) {
+            put(kNatoAlphabet[upper - 'A']);
+        } else {
+            put(glyph);
+            put(" as in ");
+            put(kNatoAlphabet[upper - 'A']);
+        }
+        i = end;
+    }
+    return len;
+}
+
+std::string spellOut(std::string_view word, Spelling mode = Spelling::Nato, int groupSize = 0) {
+    std::string out(spellInto(nullptr, word, mode, groupSize), '\0');
+    spellInto(out.data(), word, mode, groupSize);
+    return out;
+}
+
+// Spells through speech markup so the engine pauses on real breaks rather
+// than on inserted punctuation.
+void speakSpelled(const std::string &word, Spelling mode = Spelling::Letters, int groupSize = 0,
+                  const SpeechOptions &options = {}) {
+    std::string markup(spellInto(nullptr, word, mode, groupSize, true), '\0');
+    spellInto(markup.data(), word, mode, groupSize, true);
+    speakMarkup(markup, options);
+}
+
+// ---- Speech markup ------------------------------------------------------------
+// A small SSML subset: <break time|strength>, <prosody rate pitch>,
+// <emphasis level> and <say-as interpret-as>. SpeechMarkup builds it,
+// parseSpeechMarkup tokenizes it without copying, and translateSpeechMarkup
+// rewrites it for the platform engine so pauses and rate changes go out in a
+// single invocation. Unknown tags are dropped and their content kept.
+
+// Appends markup into one buffer; text is escaped as it is copied in.
+class SpeechMarkup {
+public:
+    SpeechMarkup &text(std::string_view t) {
+        appendXmlEscaped(buf_, t);
+        return *this;
+    }
+
+    SpeechMarkup &pause(int ms) {
+        buf_ += "<break time=\"";
+        appendUInt(buf_, static_cast<unsigned>(std::max(ms, 0)));
+        buf_ += "ms\"/>";
+        return *this;
+    }
+
+    // Rate is a percentage of normal speed, pitch a relative change in percent.
+    SpeechMarkup &prosody(int ratePercent, int pitchPercent = 0) {
+        buf_ += "<prosody rate=\"";
+        appendUInt(buf_, static_cast<unsigned>(std::max(ratePercent, 1)));
+        buf_ += "%\" pitch=\"";
+        buf_ += pitchPercent < 0 ? '-' : '+';
+        appendUInt(buf_, static_cast<unsigned>(std::abs(pitchPercent)));
+        buf_ += "%\">";
+        return *this;
+    }
+
+    SpeechMarkup &endProsody() {
+        buf_ += "</prosody>";
+        return *this;
+    }
+
+    SpeechMarkup &emphasis(std::string_view t, std::string_view level = "moderate") {
+        buf_ += "<emphasis level=\"";
+        buf_ += level;
+        buf_ += "\">";
+        appendXmlEscaped(buf_, t);
+        buf_ += "</emphasis>";
+        return *this;
+    }
+
+    // interpretAs: characters, spell-out, digits, telephone, cardinal, ordinal, date
+    SpeechMarkup &sayAs(std::string_view interpretAs, std::string_view t) {
+        buf_ += "<say-as interpret-as=\"";
+        buf_ += interpretAs;
+        buf_ += "\">";
+        appendXmlEscaped(buf_, t);
+        buf_ += "</say-as>";
+        return *this;
+    }
+
+    const std::string &str() const { return buf_; }
+    void clear() { buf_.clear(); }
+
+private:
+    std::string buf_;
+};
+
+struct MarkupToken {
+    enum class Kind { Text, Break, ProsodyBegin, ProsodyEnd, EmphasisBegin, EmphasisEnd, SayAsBegin, SayAsEnd };
+
+    Kind kind = Kind::Text;
+    std::string_view text;   // Text: still escaped; EmphasisBegin: level; SayAsBegin: interpret-as
+    int breakMs = 0;         // Break
+    int ratePercent = 100;   // ProsodyBegin
+    int pitchPercent = 0;    // ProsodyBegin, relative
+};
+
+// Value of name="..." (or '...') inside a tag body, empty when absent.
+static std::string_view markupAttribute(std::string_view tag, std::string_view name) {
+    size_t pos = 0;
+    while ((pos = tag.find(name, pos)) != std::string_view::npos) {
+        const size_t eq = pos + name.size();
+        const bool boundary = pos > 0 && std::isspace(static_cast<unsigned char>(tag[pos - 1]));
+        if (boundary && eq + 1 < tag.size() && tag[eq] == '=' && (tag[eq + 1] == '"' || tag[eq + 1] == '\'')) {
+            const size_t close = tag.find(tag[eq + 1], eq + 2);
+            if (close == std::string_view::npos) return {};
+            return tag.substr(eq + 2, close - eq - 2);
+        }
+        pos = eq;
+    }
+    return {};
+}
+
+// Looks value up in a keyword table, or parses a number with an optional
+// sign and suffix. Returns false when it is neither.
+static bool parseMarkupNumber(std::string_view value, double &number, std::string_view &suffix) {
+    if (!value.empty() && value[0] == '+') value.remove_prefix(1);
+    const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+    if (ec != std::errc()) return false;
+    suffix = value.substr(end - value.data());
+    return true;
+}
+
+template<size_t N>
+static bool markupKeyword(std::string_view value, const std::pair<std::string_view, int> (&table)[N], int &out) {
+    for (const auto &[key, v]: table) {
+        if (value == key) {
+            out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int markupBreakMs(std::string_view tag) {
+    static constexpr std::pair<std::string_view, int> strengths[] = {
+        {"none", 0}, {"x-weak", 100}, {"weak", 250}, {"medium", 400}, {"strong", 750}, {"x-strong", 1200}
+    };
+    double number;
+    std::string_view suffix;
+    if (parseMarkupNumber(markupAttribute(tag, "time"), number, suffix) && number >= 0)
+        return static_cast<int>(std::lround(suffix == "s" ? number * 1000 : number));
+    int ms = 400;
+    markupKeyword(markupAttribute(tag, "strength"), strengths, ms);
+    return ms;
+}
+
+static int markupRatePercent(std::string_view value) {
+    static constexpr std::pair<std::string_view, int> rates[] = {
+        {"x-slow", 50}, {"slow", 75}, {"medium", 100}, {"default", 100}, {"fast", 125}, {"x-fast", 175}
+    };
+    int percent = 100;
+    if (markupKeyword(value, rates, percent)) return percent;
+    double number;
+    std::string_view suffix;
+    if (!parseMarkupNumber(value, number, suffix)) return 100;
+    // "150%" is absolute, "+20%" / "-20%" relative, a bare number a multiplier
+    if (suffix == "%") percent = static_cast<int>(std::lround(value[0] == '+' || value[0] == '-' ? 100 + number : number));
+    else if (suffix.empty()) percent = static_cast<int>(std::lround(number * 100));
+    return std::clamp(percent, 10, 1000);
+}
+
+static int markupPitchPercent(std::string_view value) {
+    static constexpr std::pair<std::string_view, int> pitches[] = {
+        {"x-low", -50}, {"low", -25}, {"medium", 0}, {"default", 0}, {"high", 25}, {"x-high", 50}
+    };
+    int percent = 0;
+    if (markupKeyword(value, pitches, percent)) return percent;
+    double number;
+    std::string_view suffix;
+    if (parseMarkupNumber(value, number, suffix) && suffix == "%") percent = static_cast<int>(std::lround(number));
+    return std::clamp(percent, -90, 200);
+}
+
+static void parseMarkupTag(std::string_view tag, const std::function<void(const MarkupToken &)> &onToken) {
+    using Kind = MarkupToken::Kind;
+    const bool closing = !tag.empty() && tag[0] == '/';
+    if (closing) tag.remove_prefix(1);
+    size_t nameEnd = 0;
+    while (nameEnd < tag.size() && (std::isalnum(static_cast<unsigned char>(tag[nameEnd])) || tag[nameEnd] == '-'))
+        ++nameEnd;
+    const std::string_view name = tag.substr(0, nameEnd);
+
+    MarkupToken token;
+    if (name == "break") {
+        if (closing) return;
+        token.kind = Kind::Break;
+        token.breakMs = markupBreakMs(tag);
+    } else if (name == "prosody") {
+        token.kind = closing ? Kind::ProsodyEnd : Kind::ProsodyBegin;
+        token.ratePercent = markupRatePercent(markupAttribute(tag, "rate"));
+        token.pitchPercent = markupPitchPercent(markupAttribute(tag, "pitch"));
+    } else if (name == "emphasis") {
+        token.kind = closing ? Kind::EmphasisEnd : Kind::EmphasisBegin;
+        token.text = markupAttribute(tag, "level");
+        if (token.text.empty()) token.text = "moderate";
+    } else if (name == "say-as") {
+        token.kind = closing ? Kind::SayAsEnd : Kind::SayAsBegin;
+        token.text = markupAttribute(tag, "interpret-as");
+    } else {
+        return;
+    }
+    onToken(token);
+}
+
+// Calls onToken for each text run and recognised tag, in order. Text tokens
+// point into markup. A '<' only opens a tag when a name or '/' follows it and
+// a '>' closes it before the next '<'; otherwise ("a < b") it is text.
+void parseSpeechMarkup(std::string_view markup, const std::function<void(const MarkupToken &)> &onToken) {
+    auto emitText = [&](size_t begin, size_t end) {
+        if (end <= begin) return;
+        MarkupToken token;
+        token.text = markup.substr(begin, end - begin);
+        onToken(token);
+    };
+    size_t i = 0, textBegin = 0;
+    while (i < markup.size()) {
+        const size_t lt = markup.find('<', i);
+        if (lt == std::string_view::npos) break;
+        const char next = charAt(markup, lt + 1);
+        if (!isAsciiAlpha(next) && next != '/') {
+            i = lt + 1;
+            continue;
+        }
+        const size_t gt = markup.find('>', lt);
+        if (gt == std::string_view::npos) break;
+        const size_t nextLt = markup.find('<', lt + 1);
+        if (nextLt < gt) {
+            i = nextLt;
+            continue;
+        }
+        emitText(textBegin, lt);
+        parseMarkupTag(markup.substr(lt + 1, gt - lt - 1), onToken);
+        i = textBegin = gt + 1;
+    }
+    emitText(textBegin, markup.size());
+}
+
+enum class SpeechEngine { Espeak, MacSay, Sapi };
+
+#if defined(_WIN32)
+constexpr SpeechEngine kPlatformSpeechEngine = SpeechEngine::Sapi;
+#elif defined(__APPLE__)
+constexpr SpeechEngine kPlatformSpeechEngine = SpeechEngine::MacSay;
+#else
+constexpr SpeechEngine kPlatformSpeechEngine = SpeechEngine::Espeak;
+#endif
+
+// Reads the body of a <say-as> the way interpretAs asks, as plain words.
+static void appendSayAs(std::string &out, std::string_view interpretAs, std::string_view text) {
+    std::string prepared;
+    const bool allDigits = !text.empty() && text.size() <= 18 &&
+                           std::all_of(text.begin(), text.end(), [](char c) { return isAsciiDigit(c); });
+    if (interpretAs == "characters" || interpretAs == "spell-out" || interpretAs == "digits" ||
+        interpretAs == "telephone") {
+        appendLettersSeparated(prepared, text, " ", true);
+    } else if (allDigits && interpretAs == "ordinal") {
+        appendOrdinalWords(out, std::stoll(std::string(text)));
+        return;
+    } else if (allDigits && (interpretAs == "cardinal" || interpretAs == "number")) {
+        appendNumberWords(out, std::stoll(std::string(text)));
+        return;
+    } else {
+        prepared.assign(text);
+    }
+    std::string normalized;
+    normalizeForSpeech(prepared, normalized);
+    out += normalized;
+}
+
+// Rewrites markup for engine: SSML for espeak -m, embedded [[...]] commands
+// for say, SAPI XML for Windows. Text runs are normalized on the way.
+void translateSpeechMarkup(std::string_view markup, SpeechEngine engine, std::string &out,
+                           const PronunciationLexicon *lexicon = nullptr) {
+    using Kind = MarkupToken::Kind;
+    out.clear();
+    out.reserve(markup.size() + 32);
+
+    std::string raw, words;
+    std::string_view sayAsMode;
+    bool inSayAs = false;
+    // Open prosody blocks as absolute rate and pitch percentages. Each level is
+    // relative to the enclosing one, as in SSML; espeak nests that way itself,
+    // say and SAPI are given the resulting absolute values.
+    struct Prosody {
+        int ratePercent;
+        int pitchPercent;
+    };
+    std::vector<Prosody> prosody;
+    int emphasisDepth = 0;
+    const bool xml = engine != SpeechEngine::MacSay;
+
+    // Element boundaries separate words: "<emphasis>now</emphasis>ABC"
+    char lastWordChar = ' ';
+    auto emitWords = [&] {
+        if (words.empty()) return;
+        if (isAsciiAlnum(lastWordChar) && isAsciiAlnum(words.front())) out += ' ';
+        if (xml) appendXmlEscaped(out, words);
+        else out += words;
+        lastWordChar = words.back();
+    };
+    // say works in words per minute and relative semitone pitch steps. Steps
+    // are taken between absolute offsets from the base pitch, so closing a
+    // block undoes exactly what opening it did.
+    auto semitones = [](int pitchPercent) {
+        return static_cast<int>(std::lround(12 * std::log2(1 + pitchPercent / 100.0)));
+    };
+    auto sayProsody = [&](int ratePercent, int fromPitch, int toPitch) {
+        out += " [[rate ";
+        appendUInt(out, static_cast<unsigned>(175 * ratePercent / 100));
+        out += "]]";
+        const int steps = semitones(toPitch) - semitones(fromPitch);
+        if (steps) {
+            out += steps < 0 ? " [[pbas -" : " [[pbas +";
+            appendUInt(out, static_cast<unsigned>(std::abs(steps)));
+            out += "]]";
+        }
+        out += ' ';
+    };
+
+    if (engine == SpeechEngine::Espeak) out += "<speak>";
+    parseSpeechMarkup(markup, [&](const MarkupToken &t) {
+        switch (t.kind) {
+            case Kind::Text:
+                raw.clear();
+                appendXmlUnescaped(raw, t.text);
+                if (inSayAs) {
+                    words += raw;
+                } else {
+                    normalizeForSpeech(raw, words, lexicon);
+                    emitWords();
+                }
+                break;
+            case Kind::SayAsBegin:
+                inSayAs = true;
+                sayAsMode = t.text;
+                words.clear();
+                break;
+            case Kind::SayAsEnd:
+                if (!inSayAs) break;
+                inSayAs = false;
+                raw.swap(words);
+                words.clear();
+                appendSayAs(words, sayAsMode, raw);
+                emitWords();
+                break;
+            case Kind::Break:
+                lastWordChar = ' ';
+                if (engine == SpeechEngine::Espeak) out += "<break time=\"";
+                else if (engine == SpeechEngine::Sapi) out += "<silence msec='";
+                else out += " [[slnc ";
+                appendUInt(out, static_cast<unsigned>(t.breakMs));
+                out += engine == SpeechEngine::Espeak ? "ms\"/>" : xml ? "'/>" : "]] ";
+                break;
+            case Kind::ProsodyBegin: {
+                const Prosody parent = prosody.empty() ? Prosody{100, 0} : prosody.back();
+                const Prosody level{parent.ratePercent * t.ratePercent / 100,
+                                    std::max(-99, (100 + parent.pitchPercent) * (100 + t.pitchPercent) / 100 - 100)};
+                prosody.push_back(level);
+                if (engine == SpeechEngine::Espeak) {
+                    out += "<prosody rate=\"";
+                    appendUInt(out, static_cast<unsigned>(t.ratePercent));
+                    out += "%\" pitch=\"";
+                    out += t.pitchPercent < 0 ? '-' : '+';
+                    appendUInt(out, static_cast<unsigned>(std::abs(t.pitchPercent)));
+                    out += "%\">";
+                } else if (engine == SpeechEngine::Sapi) {
+                    // SAPI rates run -10..10, where +10 is about three times as
+                    // fast. Attributes are single-quoted: the XML ends up inside
+                    // powershell -Command "...", where a double quote ends it.
+                    const int speed = static_cast<int>(std::lround(10 * std::log(level.ratePercent / 100.0) / std::log(3.0)));
+                    out += "<rate absspeed='";
+                    out += std::to_string(std::clamp(speed, -10, 10));
+                    out += "'><pitch absmiddle='";
+                    out += std::to_string(std::clamp(level.pitchPercent / 5, -10, 10));
+                    out += "'>";
+                } else {
+                    sayProsody(level.ratePercent, parent.pitchPercent, level.pitchPercent);
+                }
+                break;
+            }
+            case Kind::ProsodyEnd: {
+                if (prosody.empty()) break;
+                const Prosody closed = prosody.back();
+                prosody.pop_back();
+                if (engine == SpeechEngine::Espeak) {
+                    out += "</prosody>";
+                } else if (engine == SpeechEngine::Sapi) {
+                    out += "</pitch></rate>";
+                } else {
+                    const Prosody parent = prosody.empty() ? Prosody{100, 0} : prosody.back();
+                    sayProsody(parent.ratePercent, closed.pitchPercent, parent.pitchPercent);
+                }
+                break;
+            }
+            case Kind::EmphasisBegin:
+                ++emphasisDepth;
+                if (engine == SpeechEngine::Espeak) {
+                    out += "<emphasis level=\"";
+                    appendXmlEscaped(out, t.text);
+                    out += "\">";
+                } else if (engine == SpeechEngine::Sapi) {
+                    out += "<emph>";
+                } else {
+                    out += t.text == "reduced" ? " [[emph -]] " : " [[emph +]] ";
+                }
+                break;
+            case Kind::EmphasisEnd:
+                if (!emphasisDepth) break;
+                --emphasisDepth;
+                if (engine == SpeechEngine::Espeak) out += "</emphasis>";
+                else if (engine == SpeechEngine::Sapi) out += "</emph>";
+                break;
+        }
+    });
+
+    // Close whatever the markup left open
+    if (inSayAs) {
+        raw.swap(words);
+        words.clear();
+        appendSayAs(words, sayAsMode, raw);
+        emitWords();
+    }
+    for (; emphasisDepth > 0; --emphasisDepth) {
+        if (engine == SpeechEngine::Espeak) out += "</emphasis>";
+        else if (engine == SpeechEngine::Sapi) out += "</emph>";
+    }
+    for (; !prosody.empty(); prosody.pop_back()) {
+        if (engine == SpeechEngine::Espeak) out += "</prosody>";
+        else if (engine == SpeechEngine::Sapi) out += "</pitch></rate>";
+    }
+    if (engine == SpeechEngine::Espeak) out += "</speak>";
+}
+
+static std::string escapeForShellSingleQuotes(const std::string &s) {
+    std::string out;
+    out.reserve(s.size() + 8);
+    for (char c: s) {
+        if (c == '\'') out += "'\"'\"'";
+        else out += c;
+    }
+    return out;
+}
+
+static std::string escapeForPowerShellSingleQuotes(const std::string &s) {
+    // In PowerShell single-quoted strings, escape ' by doubling it
+    std::string out;
+    out.reserve(s.size() + 8);
+    for (char c: s) {
+        if (c == '\'') out += "''";
+        else out += c;
+    }
+    return out;
+}
+
+// The options every engine call starts from; see SpeechOptions.
+static std::atomic<std::shared_ptr<const SpeechOptions> > gSpeechDefaults;
+
+void setSpeechDefaults(SpeechOptions options) {
+    gSpeechDefaults.store(std::make_shared<const SpeechOptions>(std::move(options)));
+}
+
+SpeechOptions speechDefaults() {
+    const auto defaults = gSpeechDefaults.load();
+    return defaults ? *defaults : SpeechOptions{};
+}
+
+// options with its unset fields taken from the defaults.
+static SpeechOptions resolveSpeechOptions(const SpeechOptions &options) {
+    SpeechOptions resolved = speechDefaults();
+    if (!options.voice.empty()) resolved.voice = options.voice;
+    if (options.rate > 0) resolved.rate = options.rate;
+    if (options.pitch > 0) resolved.pitch = options.pitch;
+    return resolved;
+}
+
+// Runs the platform engine on text and returns its exit status (0 on
+// success). A non-empty outputPath writes audio to that file instead of the
+// speakers.
+static int runSpeechEngine(const std::string &text, bool markup, const SpeechOptions &options,
+                           const std::string &outputPath) {
+    const SpeechOptions o = resolveSpeechOptions(options);
+#if defined(_WIN32)
+    // Everything goes inside powershell -Command "...", where a double quote
+    // would end the argument, so plain text containing one is sent as escaped
+    // XML instead; the SAPI XML itself only uses single-quoted attributes.
+    // Flag 8 (SVSFIsXML) makes SAPI parse its XML tags.
+    std::string spoken;
+    const std::string *say = &text;
+    if (!markup && text.find('"') != std::string::npos) {
+        appendXmlEscaped(spoken, text);
+        say = &spoken;
+        markup = true;
+    }
+    // SAPI has no pitch property, only the <pitch> XML tag, so plain text is
+    // escaped and wrapped when a pitch is set.
+    if (o.pitch > 0) {
+        std::string wrapped = "<pitch absmiddle='" + std::to_string(std::clamp((o.pitch - 50) / 5, -10, 10)) + "'>";
+        if (markup) wrapped += *say;
+        else appendXmlEscaped(wrapped, *say);
+        wrapped += "</pitch>";
+        spoken = std::move(wrapped);
+        say = &spoken;
+        markup = true;
+    }
+    std::string cmd = "powershell -NoProfile -Command \"$v=New-Object -ComObject SAPI.SpVoice; ";
+    if (!o.voice.empty())
+        cmd += "$v.Voice = $v.GetVoices('Name=" + escapeForPowerShellSingleQuotes(o.voice) + "').Item(0); ";
+    if (o.rate > 0) {
+        // SAPI Rate runs -10..10 around roughly 180 wpm, tripling speed every 10 steps
+        const long rate = std::lround(10.0 * std::log(o.rate / 180.0) / std::log(3.0));
+        cmd += "$v.Rate = " + std::to_string(std::clamp(rate, -10L, 10L)) + "; ";
+    }
+    if (!outputPath.empty())
+        cmd += "$s=New-Object -ComObject SAPI.SpFileStream; $s.Open('" + escapeForPowerShellSingleQuotes(outputPath) +
+               "', 3); $v.AudioOutputStream=$s; ";
+    cmd += "$null = $v.Speak('" + escapeForPowerShellSingleQuotes(*say) + (markup ? "', 8); " : "'); ");
+    if (!outputPath.empty()) cmd += "$s.Close(); ";
+    cmd += "\"";
+#elif defined(__APPLE__)
+    // say reads its [[...]] commands inline; there is no separate markup mode.
+    // It has no pitch option either, so pitch is ignored.
+    (void) markup;
+    std::string cmd = "say";
+    if (!o.voice.empty()) cmd += " -v '" + escapeForShellSingleQuotes(o.voice) + "'";
+    if (o.rate > 0) cmd += " -r " + std::to_string(o.rate);
+    if (!outputPath.empty()) cmd += " -o '" + escapeForShellSingleQuotes(outputPath) + "'";
+    cmd += " '" + escapeForShellSingleQuotes(text) + "'";
+#else
+    std::string cmd = markup ? "espeak -m" : "espeak";
+    if (!o.voice.empty()) cmd += " -v '" + escapeForShellSingleQuotes(o.voice) + "'";
+    if (o.rate > 0) cmd += " -s " + std::to_string(o.rate);
+    if (o.pitch > 0) cmd += " -p " + std::to_string(std::min(o.pitch, 99));
+    if (!outputPath.empty()) cmd += " -w '" + escapeForShellSingleQuotes(outputPath) + "'";
+    cmd += " '" + escapeForShellSingleQuotes(text) + "'";
+#endif
+    const int status = std::system(cmd.c_str());
+#if !defined(_WIN32)
+    if (status != -1 && WIFEXITED(status)) return WEXITSTATUS(status);
+#endif
+    return status;
+}
+
+static void speakRaw(const std::string &text, bool markup, const SpeechOptions &options) {
+    runSpeechEngine(text, markup, options, {});
+}
+
+void speakText(const std::string &text, const SpeechOptions &options) {
+    static thread_local std::string normalized;
+    const auto lexicon = pronunciationLexicon();
+    normalizeForSpeech(text, normalized, lexicon.get());
+    speakRaw(normalized, false, options);
+}
+
+void speakMarkup(std::string_view markup, const SpeechOptions &options) {
+    static thread_local std::string translated;
+    const auto lexicon = pronunciationLexicon();
+    translateSpeechMarkup(markup, kPlatformSpeechEngine, translated, lexicon.get());
+    speakRaw(translated, kPlatformSpeechEngine != SpeechEngine::MacSay, options);
+}
+
+void speakNumber(long long num, const SpeechOptions &options = {}) {
+    speakRaw(numberToWords(num), false, options);
+}
+
+void speakWord(const std::string &text, const SpeechOptions &options = {}) {
+    speakText(text, options);
+}
+
+// Collects utterances and speaks them in as few engine calls as possible.
+// Consecutive short utterances are merged into one markup string (separated
+// by a short break) once the oldest has waited `budget`, or earlier when the
+// batch reaches maxChars; a phrase identical to one still pending is dropped.
+// Only utterances with the same options are merged. The sink runs on the
+// scheduler's own thread, one merged utterance at a time and in order.
+class SpeechScheduler {
+public:
+    using Sink = std::function<void(std::string_view markup, const SpeechOptions &options)>;
+
+    explicit SpeechScheduler(Sink sink = speakMarkup,
+                             std::chrono::milliseconds budget = std::chrono::milliseconds(150),
+                             size_t maxChars = 400)
+        : sink_(std::move(sink)), budget_(budget), maxChars_(maxChars), worker_([this] { run(); }) {}
+
+    ~SpeechScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        worker_.join();
+    }
+
+    SpeechScheduler(const SpeechScheduler &) = delete;
+    SpeechScheduler &operator=(const SpeechScheduler &) = delete;
+
+    void say(std::string_view text, const SpeechOptions &options = {}) {
+        std::string fragment;
+        appendXmlEscaped(fragment, text);
+        enqueue(std::move(fragment), options);
+    }
+
+    void sayNumber(long long num, const SpeechOptions &options = {}) { say(numberToWords(num), options); }
+
+    void saySpelled(std::string_view word, Spelling mode = Spelling::Letters, int groupSize = 0,
+                    const SpeechOptions &options = {}) {
+        std::string fragment(spellInto(nullptr, word, mode, groupSize, true), '\0');
+        spellInto(fragment.data(), word, mode, groupSize, true);
+        enqueue(std::move(fragment), options);
+    }
+
+    void sayMarkup(std::string_view markup, const SpeechOptions &options = {}) {
+        enqueue(std::string(markup), options);
+    }
+
+    // Blocks until everything queued so far has been handed to the sink.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        flushRequested_ = true;
+        wake_.notify_all();
+        idle_.wait(lock, [this] { return pending_.empty() && !speaking_; });
+    }
+
+    size_t utterances() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return utterances_;
+    }
+    size_t engineCalls() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return engineCalls_;
+    }
+    size_t duplicates() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return duplicates_;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::string_view kUtteranceBreak = "<break time=\"300ms\"/>";
+
+    struct Utterance {
+        std::string markup;
+        SpeechOptions options;
+    };
+
+    // Utterances are duplicates only when spoken the same way too.
+    static std::string dedupeKey(const Utterance &utterance) {
+        std::string key = utterance.markup;
+        key += '\0';
+        appendSpeechOptionsKey(key, utterance.options);
+        return key;
+    }
+
+    void enqueue(std::string fragment, const SpeechOptions &options) {
+        if (fragment.empty()) return;
+        Utterance utterance{std::move(fragment), options};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++utterances_;
+            if (!pendingSet_.insert(dedupeKey(utterance)).second) {
+                ++duplicates_;
+                return;
+            }
+            if (pending_.empty()) deadline_ = Clock::now() + budget_;
+            pendingChars_ += utterance.markup.size();
+            pending_.push_back(std::move(utterance));
+        }
+        wake_.notify_all();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            if (pending_.empty()) {
+                flushRequested_ = false;
+                idle_.notify_all();
+                if (stopping_) return;
+                wake_.wait(lock);
+                continue;
+            }
+            const bool due = stopping_ || flushRequested_ || pendingChars_ >= maxChars_ || Clock::now() >= deadline_;
+            if (!due) {
+                wake_.wait_until(lock, deadline_);
+                continue;
+            }
+
+            // Merge from the front up to maxChars or a change of options; an
+            // oversized phrase goes alone. Whatever is left over is already due
+            // and goes out next.
+            std::string merged;
+            SpeechOptions options = pending_.front().options;
+            while (!pending_.empty()) {
+                const Utterance &utterance = pending_.front();
+                if (!merged.empty() && (utterance.options != options ||
+                                        merged.size() + kUtteranceBreak.size() + utterance.markup.size() > maxChars_))
+                    break;
+                if (!merged.empty()) merged += kUtteranceBreak;
+                merged += utterance.markup;
+                pendingChars_ -= utterance.markup.size();
+                pendingSet_.erase(dedupeKey(utterance));
+                pending_.pop_front();
+            }
+
+            ++engineCalls_;
+            speaking_ = true;
+            lock.unlock();
+            sink_(merged, options);
+            lock.lock();
+            speaking_ = false;
+        }
+    }
+
+    Sink sink_;
+    std::chrono::milliseconds budget_;
+    size_t maxChars_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<Utterance> pending_;
+    std::unordered_set<std::string> pendingSet_;
+    size_t pendingChars_ = 0;
+    Clock::time_point deadline_{};
+    bool flushRequested_ = false;
+    bool speaking_ = false;
+    bool stopping_ = false;
+    size_t utterances_ = 0;
+    size_t engineCalls_ = 0;
+    size_t duplicates_ = 0;
+
+    std::thread worker_; // last, so it starts after everything above exists
+};
+
+// Density ramp from dark to bright, used when converting luminance or coverage to characters.
+static constexpr char kDensityRamp[] = " .:-=+*#%@";
+static constexpr int kDensityLevels = sizeof(kDensityRamp) - 1;
+
+// Contiguous rows x cols character frame buffer. Every row is stored with a
+// trailing '\n', so a whole frame is flushed with a single fwrite.
+//
+// Drawing uses frame coordinates. A canvas normally covers the frame from
+// (0, 0), but setOrigin lets it stand for just a window of a larger frame (a
+// tile), with everything outside the window clipped away.
+class Canvas {
+public:
+    Canvas() = default;
+    Canvas(int cols, int rows, char fill = ' ')
+        : cols_(std::max(cols, 0)), rows_(std::max(rows, 0)),
+          cells_(static_cast<size_t>(cols_ + 1) * rows_, fill) {
+        for (int y = 0; y < rows_; ++y) cells_[rowOffset(y) + cols_] = '\n';
+    }
+
+    int cols() const { return cols_; }
+    int rows() const { return rows_; }
+
+    void setOrigin(int x, int y) {
+        originX_ = x;
+        originY_ = y;
+    }
+
+    // Covered frame area: [left, right) x [top, bottom).
+    int left() const { return originX_; }
+    int top() const { return originY_; }
+    int right() const { return originX_ + cols_; }
+    int bottom() const { return originY_ + rows_; }
+
+    // Storage row y (0-based, independent of the origin).
+    char *row(int y) { return cells_.data() + rowOffset(y); }
+    const char *row(int y) const { return cells_.data() + rowOffset(y); }
+
+    // Unchecked access to frame cell (x, y).
+    char *cell(int x, int y) { return row(y - originY_) + (x - originX_); }
+    char at(int x, int y) const { return row(y - originY_)[x - originX_]; }
+
+    // Writes outside the canvas are dropped.
+    void set(int x, int y, char ch) {
+        x -= originX_;
+        y -= originY_;
+        if (x >= 0 && y >= 0 && x < cols_ && y < rows_) row(y)[x] = ch;
+    }
+
+    // Copies n characters to row y starting at column x, clipped to the canvas.
+    void writeSpan(int y, int x, const char *src, int n) {
+        x -= originX_;
+        y -= originY_;
+        if (y < 0 || y >= rows_) return;
+        const int skip = std::max(0, -x);
+        const int count = std::min(n, cols_ - x) - skip;
+        if (count > 0) std::memcpy(row(y) + x + skip, src + skip, static_cast<size_t>(count));
+    }
+
+    // Copies all of src with its top-left corner at (x, y), clipped to this canvas.
+    void blit(const Canvas &src, int x, int y) {
+        const int r0 = std::max(0, top() - y);
+        const int r1 = std::min(src.rows_, bottom() - y);
+        for (int r = r0; r < r1; ++r) writeSpan(y + r, x, src.row(r), src.cols_);
+    }
+
+    // Fills the inclusive span [x0, x1] of row y, clipped to the canvas.
+    void fillSpan(int y, int x0, int x1, char ch) {
+        y -= originY_;
+        if (y < 0 || y >= rows_) return;
+        x0 = std::max(x0 - originX_, 0);
+        x1 = std::min(x1 - originX_, cols_ - 1);
+        if (x0 <= x1) std::memset(row(y) + x0, ch, static_cast<size_t>(x1 - x0 + 1));
+    }
+
+    void clear(char fill = ' ') {
+        for (int y = 0; y < rows_; ++y) std::memset(row(y), fill, static_cast<size_t>(cols_));
+    }
+
+    // The frame as text, rows separated (and terminated) by '\n'.
+    const char *data() const { return cells_.data(); }
+    size_t size() const { return cells_.size(); }
+
+    void flush(std::FILE *out = stdout) const {
+        if (!cells_.empty()) std::fwrite(cells_.data(), 1, cells_.size(), out);
+    }
+
+private:
+    size_t rowOffset(int y) const { return static_cast<size_t>(y) * (cols_ + 1); }
+
+    int cols_ = 0;
+    int rows_ = 0;
+    int originX_ = 0;
+    int originY_ = 0;
+    std::vector<char> cells_;
+};
+
+// w x h rectangle with its top-left corner at (x, y), clipped to the canvas.
+void drawRect(Canvas &canvas, int x, int y, int w, int h, char ch = '#', bool filled = true) {
+    if (w <= 0 || h <= 0) return;
+    const int yEnd = std::min(y + h, canvas.bottom());
+    for (int r = std::max(y, canvas.top()); r < yEnd; ++r) {
+        if (filled || r == y || r == y + h - 1) {
+            canvas.fillSpan(r, x, x + w - 1, ch);
+        } else {
+            canvas.set(x, r, ch);
+            canvas.set(x + w - 1, r, ch);
+        }
+    }
+}
+
+// Square of side n with its top-left corner at (x, y).
+void drawSquare(Canvas &canvas, int x, int y, int n, char ch = '#', bool filled = true) {
+    drawRect(canvas, x, y, n, n, ch, filled);
+}
+
+void drawSquare(int n, char ch = '#', bool filled = true) {
+    if (n <= 0) return;
+    Canvas canvas(n, n);
+    drawSquare(canvas, 0, 0, n, ch, filled);
+    canvas.flush();
+}
+
+// Read-only view of a bit-packed pattern. Bit c % 64 of word c / 64 in a row
+// is column c; any bits beyond `width` are zero.
+struct PatternView {
+    const std::uint64_t *words = nullptr;
+    int rows = 0;
+    int width = 0;
+    int wordsPerRow = 0;
+
+    const std::uint64_t *row(int r) const { return words + static_cast<size_t>(r) * wordsPerRow; }
+    bool bit(int r, int c) const { return row(r)[c / 64] >> (c % 64) & 1; }
+};
+
+// Compile-time pattern built from string rows (any non-space character is on),
+// e.g. `constexpr StaticPattern kHeart{{"  **   **  ", ...}};`. Rows wider than
+// 64 columns need a larger WordsPerRow.
+template <std::size_t Rows, std::size_t WordsPerRow = 1>
+struct StaticPattern {
+    std::array<std::uint64_t, Rows * WordsPerRow> words{};
+    int width = 0;
+
+    constexpr StaticPattern(const char *const (&lines)[Rows]) {
+        for (std::size_t r = 0; r < Rows; ++r) {
+            int c = 0;
+            for (; lines[r][c]; ++c) {
+                assert(c < static_cast<int>(64 * WordsPerRow) && "pattern row too wide");
+                if (lines[r][c] != ' ') words[r * WordsPerRow + c / 64] |= std::uint64_t{1} << (c % 64);
+            }
+            width = std::max(width, c);
+        }
+    }
+
+    constexpr PatternView view() const {
+        return {words.data(), static_cast<int>(Rows), width, static_cast<int>(WordsPerRow)};
+    }
+    constexpr operator PatternView() const { return view(); }
+};
+
+// Runtime counterpart of StaticPattern for patterns built from strings.
+class PackedPattern {
+public:
+    explicit PackedPattern(const std::vector<std::string> &pattern) : rows_(static_cast<int>(pattern.size())) {
+        for (const auto &row: pattern) width_ = std::max(width_, static_cast<int>(row.size()));
+        wordsPerRow_ = std::max(1, (width_ + 63) / 64);
+        words_.assign(static_cast<size_t>(rows_) * wordsPerRow_, 0);
+        for (int r = 0; r < rows_; ++r)
+            for (size_t c = 0; c < pattern[r].size(); ++c)
+                if (pattern[r][c] != ' ')
+                    words_[static_cast<size_t>(r) * wordsPerRow_ + c / 64] |= std::uint64_t{1} << (c % 64);
+    }
+
+    PatternView view() const { return {words_.data(), rows_, width_, wordsPerRow_}; }
+    operator PatternView() const { return view(); }
+
+private:
+    std::vector<std::uint64_t> words_;
+    int rows_ = 0;
+    int width_ = 0;
+    int wordsPerRow_ = 0;
+};
+
+constexpr StaticPattern kHeartSprite{{
+    "  **   **  ",
+    " **** **** ",
+    "***********",
+    " ********* ",
+    "  *******  ",
+    "   *****   ",
+    "    ***    ",
+    "     *     ",
+}};
+
+constexpr StaticPattern kSmileySprite{{
+    "  *****  ",
+    " *     * ",
+    "*  * *  *",
+    "*       *",
+    "*  ---  *",
+    " *     * ",
+    "  *****  ",
+}};
+
+// 8 pattern bits -> 8 characters, little-endian packed so one 8-byte store
+// writes a whole byte's worth of cells. Rebuilt only when on/off change.
+static const std::uint64_t *byteExpansionLut(char on, char off) {
+    static thread_local std::uint64_t lut[256];
+    static thread_local int key = -1;
+    const int wanted = static_cast<unsigned char>(on) << 8 | static_cast<unsigned char>(off);
+    if (key != wanted) {
+        for (int b = 0; b < 256; ++b) {
+            std::uint64_t cells = 0;
+            for (int i = 7; i >= 0; --i)
+                cells = cells << 8 | static_cast<unsigned char>(b >> i & 1 ? on : off);
+            lut[b] = cells;
+        }
+        key = wanted;
+    }
+    return lut;
+}
+
+// Expands one packed row into width characters (dst needs width rounded up to 8).
+static void expandPatternRow(const std::uint64_t *words, int width, const std::uint64_t *lut, char *dst) {
+    for (int c = 0; c < width; c += 8) {
+        const auto byte = static_cast<unsigned>(words[c / 64] >> (c % 64) & 0xFF);
+        std::memcpy(dst + c, &lut[byte], 8);
+    }
+}
+
+// One nibble -> 4 * scaleX characters for 2 <= scaleX <= 8, so each 4 pattern
+// bits become a single copy of up to 32 bytes.
+static const char *nibbleExpansionLut(char on, char off, int scaleX) {
+    static thread_local char lut[16][32];
+    static thread_local int key = -1;
+    const int wanted = scaleX << 16 | static_cast<unsigned char>(on) << 8 | static_cast<unsigned char>(off);
+    if (key != wanted) {
+        for (int n = 0; n < 16; ++n)
+            for (int i = 0; i < 4; ++i)
+                std::memset(lut[n] + i * scaleX, n >> i & 1 ? on : off, static_cast<size_t>(scaleX));
+        key = wanted;
+    }
+    return lut[0];
+}
+
+// Expands one packed row scaled by scaleX into dst, which needs room for the
+// width rounded up to 8 columns times scaleX.
+static void expandScaledPatternRow(const std::uint64_t *words, int width, int scaleX, char on, char off,
+                                   char *dst) {
+    if (scaleX == 1) {
+        expandPatternRow(words, width, byteExpansionLut(on, off), dst);
+    } else if (scaleX <= 8) {
+        const char *lut = nibbleExpansionLut(on, off, scaleX);
+        const size_t chunk = static_cast<size_t>(4 * scaleX);
+        for (int c = 0; c < width; c += 4) {
+            const auto nibble = static_cast<unsigned>(words[c / 64] >> (c % 64) & 0xF);
+            std::memcpy(dst + c * scaleX, lut + nibble * 32, chunk);
+        }
+    } else {
+        // Runs this long are cheap to memset one bit at a time.
+        for (int c = 0; c < width; ++c)
+            std::memset(dst + static_cast<size_t>(c) * scaleX, words[c / 64] >> (c % 64) & 1 ? on : off,
+                        static_cast<size_t>(scaleX));
+    }
+}
+
+// Pattern with its top-left corner at (x, y). Off cells are written too, so
+// the sprite is opaque. Each scaled row is built once and then copied scaleY
+// times.
+void renderAsciiArt(Canvas &canvas, int x, int y, PatternView pattern,
+                    int scaleX = 1, int scaleY = 1,
+                    char on = '#', char off = ' ')
+{
+    if (pattern.rows == 0 || scaleX < 1 || scaleY < 1) return;
+
+    const int scaledWidth = pattern.width * scaleX;
+    std::vector<char> line(static_cast<size_t>(pattern.width + 7) / 8 * 8 * scaleX);
+    for (int r = 0; r < pattern.rows; ++r) {
+        const int top = y + r * scaleY;
+        if (top >= canvas.bottom()) break;
+        if (top + scaleY <= canvas.top()) continue;
+        expandScaledPatternRow(pattern.row(r), pattern.width, scaleX, on, off, line.data());
+        for (int sy = 0; sy < scaleY; ++sy) canvas.writeSpan(top + sy, x, line.data(), scaledWidth);
+    }
+}
+
+enum class Resample {
+    Nearest,  // each target cell takes the source cell under its centre
+    Bilinear, // interpolates the four nearest source cells, on at >= 50%
+};
+
+// Pattern resampled to an arbitrary width x height with its top-left corner
+// at (x, y). Column mappings are computed once per call; with Nearest, target
+// rows that map to the same source row are copied instead of rebuilt.
+void renderAsciiArtResized(Canvas &canvas, int x, int y, PatternView pattern, int width, int height,
+                           Resample mode = Resample::Nearest, char on = '#', char off = ' ') {
+    if (pattern.rows == 0 || pattern.width == 0 || width < 1 || height < 1) return;
+
+    // Source coordinate of each target cell centre, in source cell units.
+    auto source = [](int i, int target, int src) {
+        return std::clamp((i + 0.5f) * src / target - 0.5f, 0.0f, static_cast<float>(src - 1));
+    };
+    std::vector<char> line(static_cast<size_t>(width));
+
+    if (mode == Resample::Nearest) {
+        std::vector<int> srcCol(static_cast<size_t>(width));
+        for (int i = 0; i < width; ++i) srcCol[i] = static_cast<int>(static_cast<long long>(i) * pattern.width / width);
+        int builtRow = -1;
+        for (int ty = 0; ty < height; ++ty) {
+            const int sr = static_cast<int>(static_cast<long long>(ty) * pattern.rows / height);
+            if (sr != builtRow) {
+                for (int i = 0; i < width; ++i) line[i] = pattern.bit(sr, srcCol[i]) ? on : off;
+                builtRow = sr;
+            }
+            canvas.writeSpan(y + ty, x, line.data(), width);
+        }
+        return;
+    }
+
+    std::vector<int> col0(static_cast<size_t>(width)), col1(static_cast<size_t>(width));
+    std::vector<float> colWeight(static_cast<size_t>(width));
+    for (int i = 0; i < width; ++i) {
+        const float sx = source(i, width, pattern.width);
+        col0[i] = static_cast<int>(sx);
+        col1[i] = std::min(col0[i] + 1, pattern.width - 1);
+        colWeight[i] = sx - col0[i];
+    }
+    for (int ty = 0; ty < height; ++ty) {
+        const float sy = source(ty, height, pattern.rows);
+        const int r0 = static_cast<int>(sy);
+        const int r1 = std::min(r0 + 1, pattern.rows - 1);
+        const float wy = sy - r0;
+        for (int i = 0; i < width; ++i) {
+            const float wx = colWeight[i];
+            const float top = pattern.bit(r0, col0[i]) * (1 - wx) + pattern.bit(r0, col1[i]) * wx;
+            const float bottom = pattern.bit(r1, col0[i]) * (1 - wx) + pattern.bit(r1, col1[i]) * wx;
+            line[i] = top * (1 - wy) + bottom * wy >= 0.5f ? on : off;
+        }
+        canvas.writeSpan(y + ty, x, line.data(), width);
+    }
+}
+
+void renderAsciiArt(Canvas &canvas, int x, int y, const std::vector<std::string> &pattern,
+                    int scaleX = 1, int scaleY = 1,
+                    char on = '#', char off = ' ')
+{
+    renderAsciiArt(canvas, x, y, PackedPattern(pattern).view(), scaleX, scaleY, on, off);
+}
+
+void renderAsciiArt(PatternView pattern,
+                    int scaleX = 1, int scaleY = 1,
+                    char on = '#', char off = ' ')
+{
+    if (pattern.rows == 0 || scaleX < 1 || scaleY < 1) return;
+
+    Canvas canvas(pattern.width * scaleX, pattern.rows * scaleY);
+    renderAsciiArt(canvas, 0, 0, pattern, scaleX, scaleY, on, off);
+    canvas.flush();
+}
+
+void renderAsciiArt(const std::vector<std::string>& pattern,
+                    int scaleX = 1, int scaleY = 1,
+                    char on = '#', char off = ' ')
+{
+    renderAsciiArt(PackedPattern(pattern).view(), scaleX, scaleY, on, off);
+}
+
+// Double-buffered terminal output for animations. Each presented frame is
+// diffed against the previous one row by row and only the changed runs are
+// written, each preceded by a cursor-position escape. Runs separated by fewer
+// unchanged cells than a cursor move costs are merged. The first frame, or a
+// frame of a different size, clears the screen and is written in full.
+class TerminalRenderer {
+public:
+    // out may be null to only measure what would be written.
+    explicit TerminalRenderer(std::FILE *out = stdout) : out_(out) {}
+
+    // Writes the changes needed to show frame and returns the bytes written.
+    size_t present(const Canvas &frame) {
+        buffer_.clear();
+        if (!valid_ || frame.cols() != previous_.cols() || frame.rows() != previous_.rows()) {
+            buffer_ += "\x1b[H\x1b[2J";
+            buffer_.append(frame.data(), frame.size());
+            previous_ = frame;
+            valid_ = true;
+        } else {
+            for (int y = 0; y < frame.rows(); ++y) diffRow(y, frame.row(y), previous_.row(y));
+        }
+
+        if (out_ && !buffer_.empty()) {
+            std::fwrite(buffer_.data(), 1, buffer_.size(), out_);
+            std::fflush(out_);
+        }
+        lastFrameBytes_ = buffer_.size();
+        totalBytes_ += buffer_.size();
+        ++frames_;
+        return lastFrameBytes_;
+    }
+
+    // Forces the next frame to be written in full, e.g. after other output.
+    void invalidate() { valid_ = false; }
+
+    size_t lastFrameBytes() const { return lastFrameBytes_; }
+    size_t totalBytes() const { return totalBytes_; }
+    size_t frames() const { return frames_; }
+
+private:
+    // Bytes of "\x1b[row;colH" for a typical screen position.
+    static constexpr int kMoveCost = 8;
+
+    void diffRow(int y, const char *now, char *before) {
+        const int cols = previous_.cols();
+        if (std::memcmp(now, before, static_cast<size_t>(cols)) == 0) return;
+        int x = 0;
+        while (x < cols) {
+            while (x < cols && now[x] == before[x]) ++x;
+            if (x == cols) break;
+            const int start = x;
+            int end = x; // one past the last changed cell of the run
+            while (x < cols) {
+                if (now[x] != before[x]) {
+                    end = ++x;
+                } else if (x - end >= kMoveCost) {
+                    break;
+                } else {
+                    ++x;
+                }
+            }
+            buffer_ += "\x1b[";
+            appendUInt(buffer_, static_cast<unsigned>(y + 1));
+            buffer_ += ';';
+            appendUInt(buffer_, static_cast<unsigned>(start + 1));
+            buffer_ += 'H';
+            buffer_.append(now + start, static_cast<size_t>(end - start));
+            std::memcpy(before + start, now + start, static_cast<size_t>(end - start));
+            x = end;
+        }
+    }
+
+    std::FILE *out_;
+    Canvas previous_;
+    bool valid_ = false;
+    std::string buffer_;
+    size_t lastFrameBytes_ = 0;
+    size_t totalBytes_ = 0;
+    size_t frames_ = 0;
+};
+
+// Cache of rendered, scaled patterns for sprites that are drawn over and over
+// (status icons, digits). A hit is a rectangular copy into the target canvas;
+// entries are evicted least-recently-used once their total size exceeds the
+// byte budget.
+class SpriteAtlas {
+public:
+    explicit SpriteAtlas(size_t budgetBytes = 1 << 20) : budget_(budgetBytes) {}
+
+    // Draws pattern `id` at (x, y). The caller keeps ids stable per pattern; the
+    // pattern itself is only read on a miss.
+    void blit(Canvas &canvas, int x, int y, std::uint32_t id, PatternView pattern,
+              int scaleX = 1, int scaleY = 1, char on = '#', char off = ' ') {
+        if (scaleX < 1 || scaleY < 1) return;
+        const Key key{id, scaleX, scaleY, on, off};
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, found->second);
+            canvas.blit(found->second->sprite, x, y);
+            return;
+        }
+
+        ++misses_;
+        Canvas sprite(pattern.width * scaleX, pattern.rows * scaleY);
+        renderAsciiArt(sprite, 0, 0, pattern, scaleX, scaleY, on, off);
+        canvas.blit(sprite, x, y);
+        if (sprite.size() > budget_) return; // would evict everything and still not fit
+
+        while (used_ + sprite.size() > budget_) {
+            used_ -= lru_.back().sprite.size();
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+        used_ += sprite.size();
+        lru_.push_front({key, std::move(sprite)});
+        index_.emplace(key, lru_.begin());
+    }
+
+    size_t bytesUsed() const { return used_; }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+private:
+    struct Key {
+        std::uint32_t id;
+        int scaleX;
+        int scaleY;
+        char on;
+        char off;
+
+        bool operator==(const Key &) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            std::uint64_t h = k.id;
+            h = h * 0x9E3779B97F4A7C15ULL ^ static_cast<std::uint64_t>(k.scaleX) << 32 ^ k.scaleY;
+            h = h * 0x9E3779B97F4A7C15ULL ^ static_cast<unsigned char>(k.on) << 8 ^ static_cast<unsigned char>(k.off);
+            return static_cast<size_t>(h ^ h >> 29);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        Canvas sprite;
+    };
+
+    size_t budget_;
+    size_t used_ = 0;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+};
+
+// 5x7 bitmap font for ' ' through '_' (digits, A-Z and ASCII punctuation);
+// lowercase letters use the uppercase glyphs. Bit c of a row is column c, the
+// same layout as PatternView, so glyph rows can be OR-ed straight into a line.
+static constexpr int kGlyphWidth = 5;
+static constexpr int kGlyphHeight = 7;
+static constexpr int kGlyphAdvance = kGlyphWidth + 1;
+static constexpr int kLineAdvance = kGlyphHeight + 1;
+
+static constexpr std::uint8_t kBannerFont[64][kGlyphHeight] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // '!'
+    {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, // '"'
+    {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, // '#'
+    {0x04, 0x1E, 0x05, 0x0E, 0x14, 0x0F, 0x04}, // '$'
+    {0x03, 0x13, 0x08, 0x04, 0x02, 0x19, 0x18}, // '%'
+    {0x06, 0x09, 0x05, 0x02, 0x15, 0x09, 0x16}, // '&'
+    {0x04, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, // '\''
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // '('
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // ')'
+    {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, // '*'
+    {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, // '+'
+    {0x00, 0x00, 0x00, 0x00, 0x06, 0x04, 0x02}, // ','
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, // '-'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x06}, // '.'
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // '/'
+    {0x0E, 0x11, 0x19, 0x15, 0x13, 0x11, 0x0E}, // '0'
+    {0x04, 0x06, 0x04, 0x04, 0x04, 0x04, 0x0E}, // '1'
+    {0x0E, 0x11, 0x10, 0x08, 0x04, 0x02, 0x1F}, // '2'
+    {0x1F, 0x08, 0x04, 0x08, 0x10, 0x11, 0x0E}, // '3'
+    {0x08, 0x0C, 0x0A, 0x09, 0x1F, 0x08, 0x08}, // '4'
+    {0x1F, 0x01, 0x0F, 0x10, 0x10, 0x11, 0x0E}, // '5'
+    {0x0C, 0x02, 0x01, 0x0F, 0x11, 0x11, 0x0E}, // '6'
+    {0x1F, 0x10, 0x08, 0x04, 0x02, 0x02, 0x02}, // '7'
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, // '8'
+    {0x0E, 0x11, 0x11, 0x1E, 0x10, 0x08, 0x06}, // '9'
+    {0x00, 0x06, 0x06, 0x00, 0x06, 0x06, 0x00}, // ':'
+    {0x00, 0x06, 0x06, 0x00, 0x06, 0x04, 0x02}, // ';'
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // '<'
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, // '='
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // '>'
+    {0x0E, 0x11, 0x10, 0x08, 0x04, 0x00, 0x04}, // '?'
+    {0x0E, 0x11, 0x10, 0x16, 0x15, 0x15, 0x0E}, // '@'
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // 'A'
+    {0x0F, 0x11, 0x11, 0x0F, 0x11, 0x11, 0x0F}, // 'B'
+    {0x0E, 0x11, 0x01, 0x01, 0x01, 0x11, 0x0E}, // 'C'
+    {0x07, 0x09, 0x11, 0x11, 0x11, 0x09, 0x07}, // 'D'
+    {0x1F, 0x01, 0x01, 0x0F, 0x01, 0x01, 0x1F}, // 'E'
+    {0x1F, 0x01, 0x01, 0x0F, 0x01, 0x01, 0x01}, // 'F'
+    {0x0E, 0x11, 0x01, 0x1D, 0x11, 0x11, 0x1E}, // 'G'
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, // 'H'
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, // 'I'
+    {0x1C, 0x08, 0x08, 0x08, 0x08, 0x09, 0x06}, // 'J'
+    {0x11, 0x09, 0x05, 0x03, 0x05, 0x09, 0x11}, // 'K'
+    {0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x1F}, // 'L'
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, // 'M'
+    {0x11, 0x11, 0x13, 0x15, 0x19, 0x11, 0x11}, // 'N'
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'O'
+    {0x0F, 0x11, 0x11, 0x0F, 0x01, 0x01, 0x01}, // 'P'
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x09, 0x16}, // 'Q'
+    {0x0F, 0x11, 0x11, 0x0F, 0x05, 0x09, 0x11}, // 'R'
+    {0x1E, 0x01, 0x01, 0x0E, 0x10, 0x10, 0x0F}, // 'S'
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // 'T'
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, // 'U'
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, // 'V'
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, // 'W'
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, // 'X'
+    {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}, // 'Y'
+    {0x1F, 0x10, 0x08, 0x04, 0x02, 0x01, 0x1F}, // 'Z'
+    {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, // '['
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // '\\'
+    {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, // ']'
+    {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, // '^'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, // '_'
+};
+
+static const std::uint8_t *bannerGlyph(char ch) {
+    auto c = static_cast<unsigned char>(ch);
+    if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+    if (c < 0x20 || c >= 0x60) c = '?';
+    return kBannerFont[c - 0x20];
+}
+
+// Big-letter banner for text, one band of glyph rows per '\n'-separated line.
+// Each line is composed into a single packed pattern (no per-glyph work
+// beyond OR-ing seven rows in) and drawn with renderAsciiArt at `scale`.
+Canvas renderBanner(std::string_view text, int scale = 1, char on = '#', char off = ' ') {
+    if (scale < 1) scale = 1;
+    int lines = 1, longest = 0, length = 0;
+    for (char ch: text) {
+        if (ch == '\n') {
+            ++lines;
+            length = 0;
+        } else {
+            longest = std::max(longest, ++length);
+        }
+    }
+
+    Canvas canvas(std::max(longest * kGlyphAdvance - 1, 0) * scale, (lines * kLineAdvance - 1) * scale, off);
+    const int wordsPerRow = std::max(1, (longest * kGlyphAdvance + 63) / 64);
+    std::vector<std::uint64_t> words(static_cast<size_t>(kGlyphHeight) * wordsPerRow);
+
+    int band = 0;
+    for (size_t start = 0; start <= text.size(); ++band) {
+        const size_t end = std::min(text.find('\n', start), text.size());
+        std::fill(words.begin(), words.end(), 0);
+        for (size_t i = start; i < end; ++i) {
+            const std::uint8_t *glyph = bannerGlyph(text[i]);
+            const int bit = static_cast<int>(i - start) * kGlyphAdvance;
+            const int word = bit / 64, shift = bit % 64;
+            for (int r = 0; r < kGlyphHeight; ++r) {
+                std::uint64_t *row = words.data() + static_cast<size_t>(r) * wordsPerRow;
+                row[word] |= std::uint64_t{glyph[r]} << shift;
+                if (shift > 64 - kGlyphWidth) row[word + 1] |= std::uint64_t{glyph[r]} >> (64 - shift);
+            }
+        }
+        if (end > start) {
+            const PatternView line{words.data(), kGlyphHeight,
+                                   static_cast<int>(end - start) * kGlyphAdvance - 1, wordsPerRow};
+            renderAsciiArt(canvas, 0, band * kLineAdvance * scale, line, scale, scale, on, off);
+        }
+        start = end + 1;
+    }
+    return canvas;
+}
+
+// Width in cells of a circle drawn by drawCircle.
+static int circleWidth(int radius) {
+    return 4 * radius + 1;
+}
+
+// Circle centred on cell (cx, cy).
+//
+// Characters are roughly twice as tall as they are wide in many consoles, so x
+// is scaled by 2 to make the circle look rounder. With X = 2 * dx the cell tests
+//   filled:  dx^2 + dy^2 <= r^2 + 0.25      (small fudge to avoid gaps)
+//   outline: |dx^2 + dy^2 - r^2| <= 0.85
+// become X^2 <= 4r^2 + 1 - 4dy^2 and |X^2 - (4r^2 - 4dy^2)| <= 3, all in
+// integers. Each row is then one or two [x0, x1] spans whose end points shrink
+// monotonically as |dy| grows, so they are tracked incrementally
+// (midpoint-style) instead of testing every cell of the bounding box. Only the
+// |dy| range that has a row on the canvas is walked.
+void drawCircle(Canvas &canvas, int cx, int cy, int radius, char ch = 'o', bool filled = false) {
+    if (radius <= 0) return;
+
+    // Rows cy - dy (upper half) and cy + dy (lower half) inside [top, bottom).
+    const int upperLo = std::max(cy - canvas.bottom() + 1, 0), upperHi = std::min(cy - canvas.top(), radius);
+    const int lowerLo = std::max(canvas.top() - cy, 0), lowerHi = std::min(canvas.bottom() - 1 - cy, radius);
+    int dyLo = INT_MAX, dyHi = -1;
+    if (upperLo <= upperHi) {
+        dyLo = upperLo;
+        dyHi = upperHi;
+    }
+    if (lowerLo <= lowerHi) {
+        dyLo = std::min(dyLo, lowerLo);
+        dyHi = std::max(dyHi, lowerHi);
+    }
+    if (dyHi < 0) return;
+
+    const long long r4 = 4LL * radius * radius;
+    const long long slack = filled ? 1 : 3;
+    // Largest X with X^2 <= limit, walking down from the previous row's value.
+    auto shrinkTo = [](long long x, long long limit) {
+        while (x > 0 && x * x > limit) --x;
+        return x;
+    };
+
+    // Start just above the first visible row's end points.
+    const long long firstTarget = r4 - 4LL * dyLo * dyLo;
+    long long outer = static_cast<long long>(std::sqrt(static_cast<double>(firstTarget + slack))) + 1;
+    long long inner = static_cast<long long>(std::sqrt(static_cast<double>(std::max(firstTarget - slack, 0LL)))) + 1;
+    for (int dy = dyLo; dy <= dyHi; ++dy) {
+        const long long target = r4 - 4LL * dy * dy;
+        outer = shrinkTo(outer, target + slack);
+        int spanRows[2] = {cy - dy, cy + dy};
+        const int rowCount = dy == 0 ? 1 : 2;
+
+        if (filled) {
+            for (int i = 0; i < rowCount; ++i)
+                canvas.fillSpan(spanRows[i], cx - static_cast<int>(outer), cx + static_cast<int>(outer), ch);
+            continue;
+        }
+
+        // Smallest X with X^2 >= target - 3: one past the largest X below it.
+        const long long low = target - slack;
+        long long gapEnd = 0; // first X of the outline, 0 if the row is a single span
+        if (low > 0) {
+            inner = shrinkTo(inner, low - 1);
+            gapEnd = inner + 1;
+        }
+        if (gapEnd > outer) continue;
+        for (int i = 0; i < rowCount; ++i) {
+            if (gapEnd == 0) {
+                canvas.fillSpan(spanRows[i], cx - static_cast<int>(outer), cx + static_cast<int>(outer), ch);
+            } else {
+                canvas.fillSpan(spanRows[i], cx - static_cast<int>(outer), cx - static_cast<int>(gapEnd), ch);
+                canvas.fillSpan(spanRows[i], cx + static_cast<int>(gapEnd), cx + static_cast<int>(outer), ch);
+            }
+        }
+    }
+}
+
+void drawCircle(int radius, char ch = 'o', bool filled = false) {
+    if (radius <= 0) return;
+    Canvas canvas(circleWidth(radius), 2 * radius + 1);
+    drawCircle(canvas, 2 * radius, radius, radius, ch, filled);
+    canvas.flush();
+}
+
+// Anti-aliased circle centred on cell (cx, cy), with the same 2:1 x scaling as
+// drawCircle. Each cell is supersampled on a 4x4 grid and its coverage picks a
+// character from kDensityRamp; uncovered cells are left untouched. The outline
+// is a ring `thickness` rows wide, so its weight no longer varies with radius.
+//
+// Coverage is accumulated one subsample row/column at a time across the whole
+// span of cells, a branch-free float loop the compiler vectorizes.
+void drawCircleAA(Canvas &canvas, int cx, int cy, double radius, bool filled = false, double thickness = 1.0) {
+    if (radius <= 0) return;
+    constexpr int kSub = 4;
+
+    const float outerR = static_cast<float>(filled ? radius + 0.5 : radius + thickness / 2);
+    const float innerR = static_cast<float>(filled ? -1.0 : radius - thickness / 2);
+    const float outer2 = outerR * outerR;
+    const float inner2 = innerR > 0 ? innerR * innerR : -1.0f;
+    const int reachY = static_cast<int>(std::ceil(outerR));
+    const int reachX = static_cast<int>(std::ceil(outerR * 2));
+
+    // Clip to the canvas up front so the inner loop has no bounds checks.
+    const int x0 = std::max(cx - reachX, canvas.left());
+    const int x1 = std::min(cx + reachX, canvas.right() - 1);
+    const int y0 = std::max(cy - reachY, canvas.top());
+    const int y1 = std::min(cy + reachY, canvas.bottom() - 1);
+    if (x0 > x1 || y0 > y1) return;
+
+    const int span = x1 - x0 + 1;
+    static thread_local std::vector<float> cellDx;
+    static thread_local std::vector<int> hits;
+    cellDx.resize(span);
+    hits.resize(span);
+    for (int i = 0; i < span; ++i) cellDx[i] = static_cast<float>(x0 + i - cx) / 2.0f;
+
+    for (int y = y0; y <= y1; ++y) {
+        std::fill(hits.begin(), hits.end(), 0);
+        for (int sy = 0; sy < kSub; ++sy) {
+            const float dy = static_cast<float>(y - cy) + (sy + 0.5f) / kSub - 0.5f;
+            const float dy2 = dy * dy;
+            for (int sx = 0; sx < kSub; ++sx) {
+                const float offset = ((sx + 0.5f) / kSub - 0.5f) / 2.0f;
+                for (int i = 0; i < span; ++i) {
+                    const float dx = cellDx[i] + offset;
+                    const float d2 = dx * dx + dy2;
+                    hits[i] += static_cast<int>(d2 <= outer2) & static_cast<int>(d2 >= inner2);
+                }
+            }
+        }
+        char *row = canvas.cell(x0, y);
+        for (int i = 0; i < span; ++i) {
+            const int level = (hits[i] * (kDensityLevels - 1) + kSub * kSub / 2) / (kSub * kSub);
+            if (level > 0) row[i] = kDensityRamp[level];
+        }
+    }
+}
+
+// Canvas coordinates: x grows to the right, y downwards, and (x + 0.5, y + 0.5)
+// is the centre of cell (x, y).
+struct Point {
+    float x = 0;
+    float y = 0;
+};
+
+// Bresenham line between cell (x0, y0) and cell (x1, y1), both inclusive.
+// The minor coordinate of step i along the major axis is the cell nearest the
+// ideal line, computed in integers, so only the steps whose major coordinate
+// falls inside the canvas are walked; a long line clipped to a small tile
+// costs no more than its visible part.
+void drawLine(Canvas &canvas, int x0, int y0, int x1, int y1, char ch = '#') {
+    // Nothing to do if the line's bounding box misses the canvas entirely.
+    if (std::max(x0, x1) < canvas.left() || std::max(y0, y1) < canvas.top() ||
+        std::min(x0, x1) >= canvas.right() || std::min(y0, y1) >= canvas.bottom())
+        return;
+    if (y0 == y1) {
+        canvas.fillSpan(y0, std::min(x0, x1), std::max(x0, x1), ch);
+        return;
+    }
+
+    const bool xMajor = std::abs(x1 - x0) >= std::abs(y1 - y0);
+    const int major0 = xMajor ? x0 : y0, major1 = xMajor ? x1 : y1;
+    const int minor0 = xMajor ? y0 : x0, minor1 = xMajor ? y1 : x1;
+    const long long steps = std::abs(major1 - major0);
+    const long long rise = std::abs(minor1 - minor0);
+    const int majorStep = major1 >= major0 ? 1 : -1;
+    const int minorStep = minor1 >= minor0 ? 1 : -1;
+
+    const int lo = xMajor ? canvas.left() : canvas.top();
+    const int hi = (xMajor ? canvas.right() : canvas.bottom()) - 1;
+    long long first = std::max<long long>(0, majorStep > 0 ? lo - major0 : major0 - hi);
+    long long last = std::min(steps, majorStep > 0 ? static_cast<long long>(hi) - major0
+                                                   : static_cast<long long>(major0) - lo);
+
+    // The minor offset k(i) = floor((2 i rise + steps) / (2 steps)) is monotonic,
+    // so the steps whose minor coordinate is on the canvas form a range too.
+    const int minorLo = xMajor ? canvas.top() : canvas.left();
+    const int minorHi = (xMajor ? canvas.bottom() : canvas.right()) - 1;
+    const long long kLo = std::max<long long>(0, minorStep > 0 ? minorLo - minor0 : minor0 - minorHi);
+    const long long kHi = std::min(rise, minorStep > 0 ? static_cast<long long>(minorHi) - minor0
+                                                       : static_cast<long long>(minor0) - minorLo);
+    if (kLo > kHi) return;
+    if (rise > 0) {
+        auto ceilDiv = [](long long a, long long b) { return a >= 0 ? (a + b - 1) / b : -(-a / b); };
+        first = std::max(first, ceilDiv(2 * kLo * steps - steps, 2 * rise));
+        last = std::min(last, ceilDiv((2 * kHi + 1) * steps, 2 * rise) - 1);
+    }
+    for (long long i = first; i <= last; ++i) {
+        const int major = major0 + static_cast<int>(i) * majorStep;
+        const int minor = minor0 + static_cast<int>((2 * i * rise + steps) / (2 * steps)) * minorStep;
+        if (xMajor) canvas.set(major, minor, ch);
+        else canvas.set(minor, major, ch);
+    }
+}
+
+// Ramp level of a character already on the canvas; characters outside the
+// ramp count as fully covered so anti-aliased strokes never overwrite them.
+static int rampLevelOf(char ch) {
+    for (int i = 0; i < kDensityLevels; ++i)
+        if (kDensityRamp[i] == ch) return i;
+    return kDensityLevels - 1;
+}
+
+// Plots coverage in [0, 1] as a ramp character, keeping the denser of the new
+// and existing cell so crossing strokes merge instead of erasing each other.
+static void plotCoverage(Canvas &canvas, int x, int y, float coverage) {
+    if (x < canvas.left() || y < canvas.top() || x >= canvas.right() || y >= canvas.bottom()) return;
+    const int level = static_cast<int>(coverage * (kDensityLevels - 1) + 0.5f);
+    if (level > rampLevelOf(canvas.at(x, y))) canvas.set(x, y, kDensityRamp[level]);
+}
+
+// Xiaolin Wu anti-aliased line between two cell centres given in cell units.
+void drawLineAA(Canvas &canvas, float x0, float y0, float x1, float y1) {
+    const bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+    if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+    if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+    const float gradient = x1 == x0 ? 1.0f : (y1 - y0) / (x1 - x0);
+    auto plot = [&](int major, int minor, float c) {
+        if (steep) plotCoverage(canvas, minor, major, c);
+        else plotCoverage(canvas, major, minor, c);
+    };
+
+    // Clip the major axis to the canvas, and to where either plotted minor cell
+    // can land on it. y is evaluated per step rather than accumulated so a
+    // clipped line plots exactly the cells the unclipped one does.
+    const int majorLo = steep ? canvas.top() : canvas.left();
+    const int majorHi = (steep ? canvas.bottom() : canvas.right()) - 1;
+    const float minorLo = static_cast<float>(steep ? canvas.left() : canvas.top()) - 1;
+    const float minorHi = static_cast<float>(steep ? canvas.right() : canvas.bottom());
+    float from = std::max(std::round(x0), static_cast<float>(majorLo));
+    float to = std::min(std::round(x1), static_cast<float>(majorHi));
+    if (gradient != 0) {
+        const float a = x0 + (minorLo - y0) / gradient, b = x0 + (minorHi - y0) / gradient;
+        from = std::max(from, std::floor(std::min(a, b)) - 1);
+        to = std::min(to, std::ceil(std::max(a, b)) + 1);
+    } else if (y0 < minorLo || y0 >= minorHi) {
+        return;
+    }
+    if (from > to) return;
+
+    for (int x = static_cast<int>(from); x <= static_cast<int>(to); ++x) {
+        const float y = y0 + gradient * (x - x0);
+        const float base = std::floor(y);
+        const float frac = y - base;
+        plot(x, static_cast<int>(base), 1.0f - frac);
+        plot(x, static_cast<int>(base) + 1, frac);
+    }
+}
+
+// Scanline polygon fill with an edge table sorted by starting row and an active
+// edge table of the edges crossing the current row. Cells are in when their
+// centre is inside (even-odd rule). Rows and spans are clipped to the canvas.
+// Crossings are evaluated from the edge equation rather than accumulated, so
+// a row rasterizes identically whichever row the clip window starts at.
+void fillPolygon(Canvas &canvas, const std::vector<Point> &points, char ch = '#') {
+    struct Edge {
+        int yStart; // first row whose centre the edge crosses
+        int yEnd;   // one past the last such row
+        Point from; // upper end point
+        float dxdy;
+        float x;    // crossing at the centre of the current row
+    };
+    // Scratch reused across calls: a frame of many small polygons allocates nothing.
+    static thread_local std::vector<Edge> edges;
+    static thread_local std::vector<Edge> active;
+    edges.clear();
+    active.clear();
+
+    const size_t n = points.size();
+    if (n < 3) return;
+    for (size_t i = 0; i < n; ++i) {
+        Point a = points[i], b = points[(i + 1) % n];
+        if (a.y == b.y) continue;
+        if (a.y > b.y) std::swap(a, b);
+        const int yStart = std::max(static_cast<int>(std::ceil(a.y - 0.5f)), canvas.top());
+        const int yEnd = std::min(static_cast<int>(std::ceil(b.y - 0.5f)), canvas.bottom());
+        if (yStart >= yEnd) continue;
+        edges.push_back({yStart, yEnd, a, (b.x - a.x) / (b.y - a.y), 0});
+    }
+    if (edges.empty()) return;
+    std::sort(edges.begin(), edges.end(), [](const Edge &l, const Edge &r) { return l.yStart < r.yStart; });
+
+    size_t next = 0;
+    for (int y = edges.front().yStart; y < canvas.bottom() && (next < edges.size() || !active.empty()); ++y) {
+        active.erase(std::remove_if(active.begin(), active.end(), [y](const Edge &e) { return e.yEnd <= y; }),
+                     active.end());
+        while (next < edges.size() && edges[next].yStart == y) active.push_back(edges[next++]);
+        for (auto &e: active) e.x = e.from.x + (y + 0.5f - e.from.y) * e.dxdy;
+
+        // Crossings move little between rows, so insertion sort is close to linear.
+        for (size_t i = 1; i < active.size(); ++i)
+            for (size_t j = i; j > 0 && active[j].x < active[j - 1].x; --j) std::swap(active[j], active[j - 1]);
+
+        for (size_t i = 0; i + 1 < active.size(); i += 2) {
+            const int x0 = static_cast<int>(std::ceil(active[i].x - 0.5f));
+            const int x1 = static_cast<int>(std::ceil(active[i + 1].x - 0.5f)) - 1;
+            canvas.fillSpan(y, x0, x1, ch);
+        }
+    }
+}
+
+// Connected segments through the given points (cell units), optionally
+// closed back to the first point.
+void drawPolyline(Canvas &canvas, const std::vector<Point> &points, char ch = '#', bool closed = false) {
+    const size_t segments = closed ? points.size() : points.size() - std::min<size_t>(points.size(), 1);
+    for (size_t i = 0; i < segments; ++i) {
+        const Point &a = points[i];
+        const Point &b = points[(i + 1) % points.size()];
+        drawLine(canvas, static_cast<int>(std::floor(a.x)), static_cast<int>(std::floor(a.y)),
+                 static_cast<int>(std::floor(b.x)), static_cast<int>(std::floor(b.y)), ch);
+    }
+}
+
+// Closed outline through the given points.
+void drawPolygon(Canvas &canvas, const std::vector<Point> &points, char ch = '#') {
+    drawPolyline(canvas, points, ch, true);
+}
+
+// Points along an ellipse from angle `from` to `to` (radians, clockwise on
+// screen since y points down), spaced about one cell apart.
+static std::vector<Point> ellipsePoints(Point c, float rx, float ry, float rotation, float from, float to) {
+    const float sweep = to - from;
+    const int steps = std::max(8, static_cast<int>(std::abs(sweep) * std::max(rx, ry)));
+    const float cr = std::cos(rotation), sr = std::sin(rotation);
+    std::vector<Point> pts;
+    pts.reserve(steps + 1);
+    for (int i = 0; i <= steps; ++i) {
+        const float t = from + sweep * i / steps;
+        const float ex = rx * std::cos(t), ey = ry * std::sin(t);
+        pts.push_back({c.x + ex * cr - ey * sr, c.y + ex * sr + ey * cr});
+    }
+    return pts;
+}
+
+// Ellipse centred at c (cell units) with radii rx, ry, rotated by `rotation`
+// radians. Filled ellipses are solved per row: the rotated ellipse equation is
+// a quadratic in x for a fixed y, so each row is a single span.
+void drawEllipse(Canvas &canvas, Point c, float rx, float ry, float rotation = 0, char ch = '#',
+                 bool filled = false) {
+    if (rx <= 0 || ry <= 0) return;
+    if (!filled) {
+        drawPolyline(canvas, ellipsePoints(c, rx, ry, rotation, 0, 2 * std::numbers::pi_v<float>), ch);
+        return;
+    }
+
+    // A x^2 + B x y + C y^2 <= 1 relative to the centre.
+    const float cr = std::cos(rotation), sr = std::sin(rotation);
+    const float irx2 = 1 / (rx * rx), iry2 = 1 / (ry * ry);
+    const float A = cr * cr * irx2 + sr * sr * iry2;
+    const float B = 2 * cr * sr * (irx2 - iry2);
+    const float C = sr * sr * irx2 + cr * cr * iry2;
+    // Vertical extent of the rotated ellipse.
+    const float reach = std::sqrt(rx * rx * sr * sr + ry * ry * cr * cr);
+
+    const int y0 = std::max(static_cast<int>(std::floor(c.y - reach)), canvas.top());
+    const int y1 = std::min(static_cast<int>(std::ceil(c.y + reach)), canvas.bottom() - 1);
+    for (int y = y0; y <= y1; ++y) {
+        const float dy = y + 0.5f - c.y;
+        const float b = B * dy;
+        const float disc = b * b - 4 * A * (C * dy * dy - 1);
+        if (disc < 0) continue;
+        const float root = std::sqrt(disc);
+        const float xa = c.x + (-b - root) / (2 * A);
+        const float xb = c.x + (-b + root) / (2 * A);
+        canvas.fillSpan(y, static_cast<int>(std::ceil(xa - 0.5f)), static_cast<int>(std::floor(xb - 0.5f)), ch);
+    }
+}
+
+// Elliptical arc from angle `from` to `to` (radians).
+void drawArc(Canvas &canvas, Point c, float rx, float ry, float from, float to, char ch = '#',
+             float rotation = 0) {
+    if (rx <= 0 || ry <= 0) return;
+    drawPolyline(canvas, ellipsePoints(c, rx, ry, rotation, from, to), ch);
+}
+
+// Fixed set of worker threads fed from a FIFO queue.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        workers_.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) workers_.emplace_back([this] { run(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto &worker: workers_) worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(task));
+        }
+        wake_.notify_one();
+    }
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+private:
+    void run() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) return; // stopping and drained
+                task = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()> > queue_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+// Drawing commands recorded with conservative frame-space bounding boxes, so
+// they can be replayed serially or binned to tiles by renderTiled. Commands
+// draw in insertion order; later ones paint over earlier ones.
+class DisplayList {
+public:
+    struct Bounds {
+        int x0, y0, x1, y1; // inclusive
+    };
+
+    void add(Bounds bounds, std::function<void(Canvas &)> draw) {
+        commands_.push_back({bounds, std::move(draw)});
+    }
+
+    void addRect(int x, int y, int w, int h, char ch = '#', bool filled = true) {
+        add({x, y, x + w - 1, y + h - 1}, [=](Canvas &c) { drawRect(c, x, y, w, h, ch, filled); });
+    }
+
+    void addCircle(int cx, int cy, int radius, char ch = 'o', bool filled = false) {
+        add({cx - 2 * radius, cy - radius, cx + 2 * radius, cy + radius},
+            [=](Canvas &c) { drawCircle(c, cx, cy, radius, ch, filled); });
+    }
+
+    void addLine(int x0, int y0, int x1, int y1, char ch = '#') {
+        add({std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1)},
+            [=](Canvas &c) { drawLine(c, x0, y0, x1, y1, ch); });
+    }
+
+    void addPolygon(std::vector<Point> points, char ch = '#') {
+        if (points.empty()) return;
+        Bounds b{INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+        for (const auto &p: points) {
+            b.x0 = std::min(b.x0, static_cast<int>(std::floor(p.x)));
+            b.y0 = std::min(b.y0, static_cast<int>(std::floor(p.y)));
+            b.x1 = std::max(b.x1, static_cast<int>(std::ceil(p.x)));
+            b.y1 = std::max(b.y1, static_cast<int>(std::ceil(p.y)));
+        }
+        add(b, [pts = std::move(points), ch](Canvas &c) { fillPolygon(c, pts, ch); });
+    }
+
+    void addEllipse(Point center, float rx, float ry, float rotation = 0, char ch = '#', bool filled = false) {
+        if (rx <= 0 || ry <= 0) return;
+        const float r = std::max(rx, ry) + 1;
+        const Bounds bounds{static_cast<int>(std::floor(center.x - r)), static_cast<int>(std::floor(center.y - r)),
+                            static_cast<int>(std::ceil(center.x + r)), static_cast<int>(std::ceil(center.y + r))};
+        if (filled) {
+            add(bounds, [=](Canvas &c) { drawEllipse(c, center, rx, ry, rotation, ch, true); });
+            return;
+        }
+        // Outlines are polylines; compute the points once rather than per tile.
+        add(bounds, [pts = ellipsePoints(center, rx, ry, rotation, 0, 2 * std::numbers::pi_v<float>), ch](Canvas &c) {
+            drawPolyline(c, pts, ch);
+        });
+    }
+
+    void addLineAA(float x0, float y0, float x1, float y1) {
+        add({static_cast<int>(std::floor(std::min(x0, x1))) - 1, static_cast<int>(std::floor(std::min(y0, y1))) - 1,
+             static_cast<int>(std::ceil(std::max(x0, x1))) + 1, static_cast<int>(std::ceil(std::max(y0, y1))) + 1},
+            [=](Canvas &c) { drawLineAA(c, x0, y0, x1, y1); });
+    }
+
+    // The pattern's storage must outlive the list.
+    void addArt(int x, int y, PatternView pattern, int scaleX = 1, int scaleY = 1, char on = '#', char off = ' ') {
+        add({x, y, x + pattern.width * scaleX - 1, y + pattern.rows * scaleY - 1},
+            [=](Canvas &c) { renderAsciiArt(c, x, y, pattern, scaleX, scaleY, on, off); });
+    }
+
+    // Serial replay; the reference result renderTiled must reproduce.
+    void draw(Canvas &canvas) const {
+        for (const auto &command: commands_) command.draw(canvas);
+    }
+
+    size_t size() const { return commands_.size(); }
+    void clear() { commands_.clear(); }
+
+private:
+    friend void renderTiled(Canvas &, const DisplayList &, ThreadPool &, int, int);
+
+    struct Command {
+        Bounds bounds;
+        std::function<void(Canvas &)> draw;
+    };
+
+    std::vector<Command> commands_;
+};
+
+// Renders a display list into canvas split into tileCols x tileRows tiles
+// (the default is 4 KB of cells, comfortably cache resident). A binning pass
+// assigns each command to the tiles its bounds touch, in list order; the pool
+// then renders whole tiles, each into a private canvas windowed onto the frame
+// and seeded with the frame's current contents. Tiles are disjoint and every
+// primitive rasterizes a cell the same way whatever window it is clipped to,
+// so the result is identical to list.draw(canvas).
+//
+// Blocks until done; don't call it from a task running on the same pool.
+void renderTiled(Canvas &canvas, const DisplayList &list, ThreadPool &pool, int tileCols = 128, int tileRows = 32) {
+    if (canvas.cols() == 0 || canvas.rows() == 0) return;
+    tileCols = std::max(tileCols, 1);
+    tileRows = std::max(tileRows, 1);
+    const int tilesX = (canvas.cols() + tileCols - 1) / tileCols;
+    const int tilesY = (canvas.rows() + tileRows - 1) / tileRows;
+
+    std::vector<std::vector<std::uint32_t> > bins(static_cast<size_t>(tilesX) * tilesY);
+    for (size_t i = 0; i < list.commands_.size(); ++i) {
+        const auto &b = list.commands_[i].bounds;
+        if (b.x1 < canvas.left() || b.y1 < canvas.top()) continue;
+        const int tx0 = std::max(b.x0 - canvas.left(), 0) / tileCols;
+        const int ty0 = std::max(b.y0 - canvas.top(), 0) / tileRows;
+        const int tx1 = std::min(b.x1 - canvas.left(), canvas.cols() - 1) / tileCols;
+        const int ty1 = std::min(b.y1 - canvas.top(), canvas.rows() - 1) / tileRows;
+        for (int ty = ty0; ty <= ty1; ++ty)
+            for (int tx = tx0; tx <= tx1; ++tx)
+                bins[static_cast<size_t>(ty) * tilesX + tx].push_back(static_cast<std::uint32_t>(i));
+    }
+
+    std::atomic<int> nextTile{0};
+    const unsigned workers = std::min<unsigned>(pool.size(), static_cast<unsigned>(bins.size()));
+    std::latch done(workers);
+    for (unsigned w = 0; w < workers; ++w) {
+        pool.submit([&] {
+            for (int t = nextTile++; t < static_cast<int>(bins.size()); t = nextTile++) {
+                if (bins[t].empty()) continue;
+                const int x = canvas.left() + t % tilesX * tileCols;
+                const int y = canvas.top() + t / tilesX * tileRows;
+                Canvas tile(std::min(tileCols, canvas.right() - x), std::min(tileRows, canvas.bottom() - y));
+                tile.setOrigin(x, y);
+                for (int r = 0; r < tile.rows(); ++r) tile.writeSpan(y + r, x, canvas.cell(x, y + r), tile.cols());
+                for (std::uint32_t i: bins[t]) list.commands_[i].draw(tile);
+                canvas.blit(tile, x, y);
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+}
+
+struct ImageInfo {
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+};
+
+bool probeImage(const std::string &path, ImageInfo &info) {
+    info.path = path;
+    return stbi_info(path.c_str(), &info.width, &info.height, &info.channels) != 0;
+}
+
+bool probeImageFromMemory(const unsigned char *data, int len, ImageInfo &info) {
+    return stbi_info_from_memory(data, len, &info.width, &info.height, &info.channels) != 0;
+}
+
+struct ImageJob {
+    ImageInfo info;
+    size_t pixelOffset = 0; // decoded pixels inside ImageBatchPlan::arena
+    size_t gridOffset = 0;  // character grid inside ImageBatchPlan::arena
+    int gridCols = 0;
+    int gridRows = 0;
+
+    size_t pixelBytes() const {
+        return static_cast<size_t>(info.width) * info.height * info.channels;
+    }
+
+    // Each grid row carries a trailing '\n' so the grid can be written in one go.
+    size_t gridBytes() const { return static_cast<size_t>(gridCols + 1) * gridRows; }
+};
+
+struct ImageBatchPlan {
+    std::vector<ImageJob> jobs; // largest first
+    std::vector<std::pair<std::string, std::string> > rejected; // path, reason
+    std::vector<unsigned char> arena;
+
+    const unsigned char *pixels(const ImageJob &job) const { return arena.data() + job.pixelOffset; }
+    const char *grid(const ImageJob &job) const {
+        return reinterpret_cast<const char *>(arena.data() + job.gridOffset);
+    }
+};
+
+// Probes every input with stbi_info (header only, no decode), rejects unreadable
+// or oversize images, orders the rest by size and lays out a single arena that
+// holds all decoded pixels and character grids.
+ImageBatchPlan planImageBatch(const std::vector<std::string> &paths, int gridCols,
+                              long long maxPixels = 64LL * 1024 * 1024) {
+    ImageBatchPlan plan;
+    if (gridCols < 1) gridCols = 1;
+
+    for (const auto &path: paths) {
+        ImageJob job;
+        if (!probeImage(path, job.info)) {
+            const char *why = stbi_failure_reason();
+            plan.rejected.emplace_back(path, why ? why : "unreadable");
+            continue;
+        }
+        if (static_cast<long long>(job.info.width) * job.info.height > maxPixels) {
+            plan.rejected.emplace_back(path, "too large");
+            continue;
+        }
+        job.gridCols = std::min(gridCols, job.info.width);
+        // Characters are about twice as tall as wide, so halve the row count.
+        job.gridRows = std::max(1, static_cast<int>(
+                                       static_cast<long long>(job.info.height) * job.gridCols / job.info.width / 2));
+        plan.jobs.push_back(std::move(job));
+    }
+
+    // Largest first: the expensive decodes start early and the small ones fill in.
+    std::stable_sort(plan.jobs.begin(), plan.jobs.end(), [](const ImageJob &a, const ImageJob &b) {
+        return a.pixelBytes() > b.pixelBytes();
+    });
+
+    size_t total = 0;
+    for (auto &job: plan.jobs) {
+        job.pixelOffset = total;
+        total += job.pixelBytes();
+    }
+    for (auto &job: plan.jobs) {
+        job.gridOffset = total;
+        total += job.gridBytes();
+    }
+    plan.arena.resize(total);
+    return plan;
+}
+
+struct Rgb {
+    unsigned char r = 0, g = 0, b = 0;
+
+    bool operator==(const Rgb &) const = default;
+};
+
+// Rec. 601 luma in fixed point.
+static unsigned luma(Rgb c) {
+    return (77u * c.r + 150u * c.g + 29u * c.b) >> 8;
+}
+
+// Box-filters the source pixels covered by cell (gx, gy) of a cols x rows grid.
+// Gray(+alpha) images replicate the first channel.
+static Rgb sampleCell(const unsigned char *pixels, int width, int height, int channels,
+                      int cols, int rows, int gx, int gy) {
+    const int y0 = static_cast<int>(static_cast<long long>(gy) * height / rows);
+    const int y1 = std::max(y0 + 1, static_cast<int>(static_cast<long long>(gy + 1) * height / rows));
+    const int x0 = static_cast<int>(static_cast<long long>(gx) * width / cols);
+    const int x1 = std::max(x0 + 1, static_cast<int>(static_cast<long long>(gx + 1) * width / cols));
+    const int gOff = channels >= 3 ? 1 : 0;
+    const int bOff = channels >= 3 ? 2 : 0;
+    unsigned long r = 0, g = 0, b = 0;
+    for (int y = y0; y < y1; ++y) {
+        const unsigned char *p = pixels + (static_cast<size_t>(y) * width + x0) * channels;
+        for (int x = x0; x < x1; ++x, p += channels) {
+            r += p[0];
+            g += p[gOff];
+            b += p[bOff];
+        }
+    }
+    const unsigned long n = static_cast<unsigned long>(y1 - y0) * (x1 - x0);
+    return {static_cast<unsigned char>(r / n), static_cast<unsigned char>(g / n), static_cast<unsigned char>(b / n)};
+}
+
+// Box-filters the image down to cols x rows cells and maps each cell's
+// luminance onto kDensityRamp. Rows are written with a trailing '\n'.
+void imageToAscii(const unsigned char *pixels, int width, int height, int channels,
+                  int cols, int rows, char *grid) {
+    for (int gy = 0; gy < rows; ++gy) {
+        char *out = grid + static_cast<size_t>(gy) * (cols + 1);
+        for (int gx = 0; gx < cols; ++gx) {
+            const unsigned lum = luma(sampleCell(pixels, width, height, channels, cols, rows, gx, gy));
+            out[gx] = kDensityRamp[lum * kDensityLevels / 256];
+        }
+        out[cols] = '\n';
+    }
+}
+
+// Downsampled luminance, one byte per cell, row-major cols x rows.
+std::vector<unsigned char> luminanceGrid(const unsigned char *pixels, int width, int height, int channels,
+                                         int cols, int rows) {
+    std::vector<unsigned char> lum(static_cast<size_t>(cols) * rows);
+    for (int gy = 0; gy < rows; ++gy)
+        for (int gx = 0; gx < cols; ++gx)
+            lum[static_cast<size_t>(gy) * cols + gx] =
+                    static_cast<unsigned char>(luma(sampleCell(pixels, width, height, channels, cols, rows, gx, gy)));
+    return lum;
+}
+
+enum class Dither {
+    None,           // plain binning, same as imageToAscii
+    FloydSteinberg, // error diffusion to 4 neighbours over 2 rows
+    Atkinson,       // error diffusion of 3/4 of the error over 3 rows; keeps more contrast
+    Bayer,          // 8x8 ordered threshold map; no dependencies between cells
+};
+
+static int nearestRampLevel(int v) {
+    v = std::clamp(v, 0, 255);
+    return (v * (kDensityLevels - 1) + 127) / 255;
+}
+
+static int rampLevelValue(int level) {
+    return level * 255 / (kDensityLevels - 1);
+}
+
+// Ordered dithering of rows [rowBegin, rowEnd). Every cell depends only on its
+// own value and position, so the loop vectorizes and disjoint row bands can be
+// processed independently (e.g. one tile per thread).
+void ditherOrderedRows(const unsigned char *lum, int cols, int rowBegin, int rowEnd, char *grid) {
+    static constexpr unsigned char bayer8[8][8] = {
+        {0, 32, 8, 40, 2, 34, 10, 42},
+        {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44, 4, 36, 14, 46, 6, 38},
+        {60, 28, 52, 20, 62, 30, 54, 22},
+        {3, 35, 11, 43, 1, 33, 9, 41},
+        {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47, 7, 39, 13, 45, 5, 37},
+        {63, 31, 55, 23, 61, 29, 53, 21},
+    };
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        const unsigned char *in = lum + static_cast<size_t>(y) * cols;
+        const unsigned char *threshold = bayer8[y & 7];
+        char *out = grid + static_cast<size_t>(y) * (cols + 1);
+        for (int x = 0; x < cols; ++x) {
+            // floor(v * (levels - 1) / 255 + (t + 0.5) / 64) in integers.
+            const unsigned level = (in[x] * (kDensityLevels - 1) * 128u + (2u * threshold[x & 7] + 1) * 255u) /
+                                   (255u * 128u);
+            out[x] = kDensityRamp[level];
+        }
+        out[cols] = '\n';
+    }
+}
+
+// Error diffusion keeps only the rows the kernel reaches (two for
+// Floyd-Steinberg, three for Atkinson) in small rolling buffers, so the working
+// set stays in L1 regardless of the grid height.
+static void ditherErrorDiffusion(const unsigned char *lum, int cols, int rows, bool atkinson, char *grid) {
+    const int rowCount = atkinson ? 3 : 2;
+    std::vector<int> buffer(static_cast<size_t>(rowCount) * (cols + 4), 0);
+    // Two cells of padding on each side so the kernels never need bounds checks.
+    auto errRow = [&](int y) { return buffer.data() + static_cast<size_t>(y % rowCount) * (cols + 4) + 2; };
+
+    for (int y = 0; y < rows; ++y) {
+        int *cur = errRow(y);
+        int *next = errRow(y + 1);
+        int *next2 = atkinson ? errRow(y + 2) : nullptr;
+        // The row that scrolls in at the bottom starts without any error.
+        std::fill(atkinson ? next2 - 2 : next - 2, (atkinson ? next2 : next) + cols + 2, 0);
+
+        const unsigned char *in = lum + static_cast<size_t>(y) * cols;
+        char *out = grid + static_cast<size_t>(y) * (cols + 1);
+        for (int x = 0; x < cols; ++x) {
+            const int v = in[x] + cur[x];
+            const int level = nearestRampLevel(v);
+            const int err = v - rampLevelValue(level);
+            out[x] = kDensityRamp[level];
+            if (atkinson) {
+                const int e = err / 8;
+                cur[x + 1] += e;
+                cur[x + 2] += e;
+                next[x - 1] += e;
+                next[x] += e;
+                next[x + 1] += e;
+                next2[x] += e;
+            } else {
+                cur[x + 1] += err * 7 / 16;
+                next[x - 1] += err * 3 / 16;
+                next[x] += err * 5 / 16;
+                next[x + 1] += err / 16;
+            }
+        }
+        out[cols] = '\n';
+    }
+}
+
+// Maps a luminance grid onto kDensityRamp with the chosen dithering. grid gets
+// rows * (cols + 1) bytes, each row ending in '\n'.
+void ditherToRamp(const unsigned char *lum, int cols, int rows, Dither method, char *grid) {
+    switch (method) {
+        case Dither::None:
+            for (int y = 0; y < rows; ++y) {
+                char *out = grid + static_cast<size_t>(y) * (cols + 1);
+                for (int x = 0; x < cols; ++x)
+                    out[x] = kDensityRamp[lum[static_cast<size_t>(y) * cols + x] * kDensityLevels / 256];
+                out[cols] = '\n';
+            }
+            break;
+        case Dither::FloydSteinberg:
+            ditherErrorDiffusion(lum, cols, rows, false, grid);
+            break;
+        case Dither::Atkinson:
+            ditherErrorDiffusion(lum, cols, rows, true, grid);
+            break;
+        case Dither::Bayer:
+            ditherOrderedRows(lum, cols, 0, rows, grid);
+            break;
+    }
+}
+
+enum class ColorMode {
+    TrueColor,  // 24-bit "38;2;r;g;b" escapes
+    Palette256, // xterm 256-color cube and gray ramp
+};
+
+// Nearest xterm-256 index: either the 6x6x6 cube (16..231) or the gray ramp (232..255).
+static unsigned char toPalette256(Rgb c) {
+    auto level = [](unsigned v) { return v < 48 ? 0u : v < 115 ? 1u : (v - 35) / 40; };
+    static constexpr unsigned steps[6] = {0, 95, 135, 175, 215, 255};
+    const unsigned lr = level(c.r), lg = level(c.g), lb = level(c.b);
+    const unsigned avg = (c.r + c.g + c.b) / 3;
+    const unsigned grayIdx = avg > 238 ? 23 : avg < 3 ? 0 : (avg - 3) / 10;
+    const unsigned grayVal = 8 + 10 * grayIdx;
+    auto dist = [&](unsigned r, unsigned g, unsigned b) {
+        const int dr = static_cast<int>(r) - c.r, dg = static_cast<int>(g) - c.g, db = static_cast<int>(b) - c.b;
+        return dr * dr + dg * dg + db * db;
+    };
+    if (dist(grayVal, grayVal, grayVal) < dist(steps[lr], steps[lg], steps[lb]))
+        return static_cast<unsigned char>(232 + grayIdx);
+    return static_cast<unsigned char>(16 + 36 * lr + 6 * lg + lb);
+}
+
+// Appends SGR color escapes to a buffer, skipping any escape that would not
+// change the current terminal state. That coalescing is what keeps colored
+// output within a small factor of the plain-text size.
+class AnsiColorWriter {
+public:
+    AnsiColorWriter(std::string &out, ColorMode mode) : out_(out), mode_(mode) {}
+
+    void foreground(Rgb c) { set(c, fg_, 38); }
+    void background(Rgb c) { set(c, bg_, 48); }
+
+    void reset() {
+        if (fg_ >= 0 || bg_ >= 0) out_ += "\x1b[0m";
+        fg_ = bg_ = -1;
+    }
+
+private:
+    void set(Rgb c, long &current, unsigned selector) {
+        // TrueColor keys on the packed RGB value, Palette256 on the palette index,
+        // so nearby colors that share an index also share a run.
+        const long key = mode_ == ColorMode::TrueColor ? (c.r << 16 | c.g << 8 | c.b) : toPalette256(c);
+        if (key == current) return;
+        current = key;
+        out_ += "\x1b[";
+        appendUInt(out_, selector);
+        if (mode_ == ColorMode::TrueColor) {
+            out_ += ";2;";
+            appendUInt(out_, c.r);
+            out_ += ';';
+            appendUInt(out_, c.g);
+            out_ += ';';
+            appendUInt(out_, c.b);
+        } else {
+            out_ += ";5;";
+            appendUInt(out_, static_cast<unsigned>(key));
+        }
+        out_ += 'm';
+    }
+
+    std::string &out_;
+    ColorMode mode_;
+    long fg_ = -1;
+    long bg_ = -1;
+};
+
+// Like imageToAscii, but each cell's character is drawn in the cell's average
+// color. Blank cells don't change the color, so they never start a new run.
+void imageToAnsi(const unsigned char *pixels, int width, int height, int channels,
+                 int cols, int rows, ColorMode mode, std::string &out) {
+    AnsiColorWriter color(out, mode);
+    for (int gy = 0; gy < rows; ++gy) {
+        for (int gx = 0; gx < cols; ++gx) {
+            const Rgb c = sampleCell(pixels, width, height, channels, cols, rows, gx, gy);
+            const char ch = kDensityRamp[luma(c) * kDensityLevels / 256];
+            if (ch != ' ') color.foreground(c);
+            out += ch;
+        }
+        out += '\n';
+    }
+    color.reset();
+}
+
+// One byte per pixel (0 = off). Input for the sub-cell renderers below, which
+// pack several pixels into each character cell.
+struct Bitmap {
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> bits;
+
+    Bitmap() = default;
+    Bitmap(int w, int h) : width(w), height(h), bits(static_cast<size_t>(w) * h) {}
+
+    // Out-of-range reads are off, which pads partial cells at the edges.
+    bool at(int x, int y) const {
+        return x >= 0 && y >= 0 && x < width && y < height && bits[static_cast<size_t>(y) * width + x];
+    }
+    void set(int x, int y, bool on = true) { bits[static_cast<size_t>(y) * width + x] = on; }
+};
+
+// Circle on square pixels. The filled test matches drawCircle; the outline band
+// scales with the radius so it stays about one pixel wide.
+Bitmap circleBitmap(int radius, bool filled = false) {
+    if (radius <= 0) return {};
+    const int size = 2 * radius + 1;
+    const double r2 = static_cast<double>(radius) * radius;
+    Bitmap bmp(size, size);
+    for (int y = 0; y < size; ++y) {
+        const double dy = y - radius;
+        for (int x = 0; x < size; ++x) {
+            const double dx = x - radius;
+            const double dist2 = dx * dx + dy * dy;
+            bmp.set(x, y, filled ? dist2 <= r2 + 0.25 : std::abs(dist2 - r2) <= radius * 0.85);
+        }
+    }
+    return bmp;
+}
+
+// Unpacks a renderAsciiArt pattern into one byte per pixel.
+Bitmap patternBitmap(PatternView pattern) {
+    Bitmap bmp(pattern.width, pattern.rows);
+    for (int r = 0; r < pattern.rows; ++r)
+        for (int c = 0; c < pattern.width; ++c)
+            bmp.set(c, r, pattern.bit(r, c));
+    return bmp;
+}
+
+// Resamples an image to width x height pixels and thresholds the luminance.
+Bitmap thresholdImage(const unsigned char *pixels, int width, int height, int channels,
+                      int outWidth, int outHeight, unsigned threshold = 128) {
+    Bitmap bmp(outWidth, outHeight);
+    for (int y = 0; y < outHeight; ++y)
+        for (int x = 0; x < outWidth; ++x)
+            bmp.set(x, y, luma(sampleCell(pixels, width, height, channels, outWidth, outHeight, x, y)) >= threshold);
+    return bmp;
+}
+
+// 1x2 pixels per cell: top/bottom pair -> ' ', U+2580, U+2584, U+2588.
+void bitmapToHalfBlocks(const Bitmap &bmp, std::string &out) {
+    static const char *const cells[4] = {" ", "\u2580", "\u2584", "\u2588"};
+    for (int y = 0; y < bmp.height; y += 2) {
+        for (int x = 0; x < bmp.width; ++x)
+            out += cells[bmp.at(x, y) | bmp.at(x, y + 1) << 1];
+        out += '\n';
+    }
+}
+
+// 1x2 pixels per cell in color: U+2580 with the top pixel as foreground and the
+// bottom one as background. cols x rows are cells, i.e. rows * 2 pixel rows.
+void imageToHalfBlocks(const unsigned char *pixels, int width, int height, int channels,
+                       int cols, int rows, ColorMode mode, std::string &out) {
+    AnsiColorWriter color(out, mode);
+    for (int gy = 0; gy < rows; ++gy) {
+        for (int gx = 0; gx < cols; ++gx) {
+            const Rgb top = sampleCell(pixels, width, height, channels, cols, rows * 2, gx, gy * 2);
+            const Rgb bottom = sampleCell(pixels, width, height, channels, cols, rows * 2, gx, gy * 2 + 1);
+            color.background(bottom);
+            if (top == bottom) {
+                out += ' ';
+            } else {
+                color.foreground(top);
+                out += "\u2580";
+            }
+        }
+        // Reset before the newline so the background does not bleed into the margin.
+        color.reset();
+        out += '\n';
+    }
+}
+
+// 2x4 pixels per cell as Unicode braille (U+2800 + dot bits). Dot numbering is
+// column-major for the upper 3 rows with the 4th row in the high bits, so each
+// pixel row contributes its 2-bit pair through a lookup table.
+void bitmapToBraille(const Bitmap &bmp, std::string &out) {
+    static constexpr unsigned char rowBits[4][4] = {
+        {0x00, 0x01, 0x08, 0x09},
+        {0x00, 0x02, 0x10, 0x12},
+        {0x00, 0x04, 0x20, 0x24},
+        {0x00, 0x40, 0x80, 0xC0},
+    };
+    for (int y = 0; y < bmp.height; y += 4) {
+        for (int x = 0; x < bmp.width; x += 2) {
+            unsigned dots = 0;
+            for (int dy = 0; dy < 4; ++dy)
+                dots |= rowBits[dy][bmp.at(x, y + dy) | bmp.at(x + 1, y + dy) << 1];
+            // U+2800 + dots, UTF-8 encoded.
+            out += static_cast<char>(0xE2);
+            out += static_cast<char>(0xA0 | dots >> 6);
+            out += static_cast<char>(0x80 | (dots & 0x3F));
+        }
+        out += '\n';
+    }
+}
+
+// Decodes every planned job into the arena and fills in its character grid.
+// Returns false if any image fails to decode; its grid is left blank.
+bool decodeImageBatch(ImageBatchPlan &plan) {
+    bool ok = true;
+    for (const auto &job: plan.jobs) {
+        StbiArenaScope scratch; // zlib and row buffers are recycled between images
+        char *grid = reinterpret_cast<char *>(plan.arena.data() + job.gridOffset);
+        int w = 0, h = 0, n = 0;
+        unsigned char *data = stbi_load(job.info.path.c_str(), &w, &h, &n, job.info.channels);
+        if (!data || w != job.info.width || h != job.info.height) {
+            stbi_image_free(data);
+            std::memset(grid, ' ', job.gridBytes());
+            for (int r = 0; r < job.gridRows; ++r) grid[static_cast<size_t>(r) * (job.gridCols + 1) + job.gridCols] = '\n';
+            ok = false;
+            continue;
+        }
+        std::memcpy(plan.arena.data() + job.pixelOffset, data, job.pixelBytes());
+        stbi_image_free(data);
+        imageToAscii(plan.pixels(job), w, h, job.info.channels, job.gridCols, job.gridRows, grid);
+    }
+    return ok;
+}
+
+// untitled --bench-decode N file...
+//
+// Decodes the files from memory N times each with and without the stb_image
+// arena, alternating between the two every round so drift hits both alike,
+// and prints the mean time per decode for each.
+static int runDecodeBenchmark(const std::vector<std::string> &paths, int rounds) {
+    std::vector<std::vector<unsigned char> > files;
+    for (const auto &path: paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::fprintf(stderr, "cannot open %s\n", path.c_str());
+            return 2;
+        }
+        files.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Clock::duration spent[2]{}; // malloc, arena
+    for (int round = -1; round < rounds; ++round) { // round -1 warms both up
+        for (int arena = 0; arena < 2; ++arena) {
+            const auto start = Clock::now();
+            for (const auto &file: files) {
+                std::unique_ptr<StbiArenaScope> scope;
+                if (arena) scope = std::make_unique<StbiArenaScope>();
+                int w, h, n;
+                unsigned char *data = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &w, &h, &n, 0);
+                if (!data) {
+                    std::fprintf(stderr, "cannot decode %s\n", paths[&file - files.data()].c_str());
+                    return 1;
+                }
+                stbi_image_free(data);
+            }
+            if (round >= 0) spent[arena] += Clock::now() - start;
+        }
+    }
+    const double decodes = static_cast<double>(rounds) * static_cast<double>(files.size());
+    for (int arena = 1; arena >= 0; --arena) {
+        std::printf("%-7s %.2f ms/decode\n", arena ? "arena:" : "malloc:",
+                    std::chrono::duration<double, std::milli>(spent[arena]).count() / decodes);
+    }
+    return 0;
+}
+
+// Looks for a bundled resource next to the working directory, the build
+// directory and finally the source directory.
+std::string findResource(const std::string &name) {
+    const std::vector<std::string> dirs{
+        ".",
+#ifdef PROJECT_BINARY_DIR
+        PROJECT_BINARY_DIR,
+#endif
+#ifdef PROJECT_SOURCE_DIR
+        PROJECT_SOURCE_DIR,
+#endif
+    };
+    for (const auto &dir: dirs) {
+        std::string path = dir + "/" + name;
+        if (std::ifstream(path).good()) return path;
+    }
+    return name;
+}
+
+// ---- Batch speech jobs -------------------------------------------------------
+// untitled --batch [file|-] [--jobs N] [--dry-run] [--lexicon file]
+//
+// Reads one job per line from a file or stdin. A plain line is text to speak;
+// a line starting with '{' is a JSON object with exactly one of "text",
+// "number" or "spell", plus optional "voice", "rate" (words per minute),
+// "pitch" (1-99), "output" (audio file) and "id".
+// Jobs are normalized and synthesized on a thread pool, and one JSON status
+// line per job is streamed to stdout as it finishes (so not in input order).
+// --dry-run stops before the engine and reports the prepared text instead.
+
+struct SpeechJob {
+    size_t line = 0;
+    std::string id;
+    std::string text;
+    std::string spell;
+    long long number = 0;
+    bool hasNumber = false;
+    SpeechOptions options;
+    std::string output;
+};
+
+// Minimal JSON for job lines: one flat object whose values are strings,
+// numbers, booleans or null. Values come back as text, strings unescaped.
+static bool parseFlatJsonObject(std::string_view s, std::vector<std::pair<std::string, std::string> > &fields,
+                                std::string &error) {
+    size_t i = 0;
+    auto skipSpace = [&] {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) ++i;
+    };
+    auto hex4 = [&](char32_t &cp) {
+        if (i + 4 > s.size()) return false;
+        cp = 0;
+        for (int k = 0; k < 4; ++k) {
+            const char c = s[i++];
+            const int digit = isAsciiDigit(c) ? c - '0' : (asciiLower(c) >= 'a' && asciiLower(c) <= 'f') ? asciiLower(c) - 'a' + 10 : -1;
+            if (digit < 0) return false;
+            cp = cp << 4 | static_cast<char32_t>(digit);
+        }
+        return true;
+    };
+    auto parseString = [&](std::string &out) {
+        ++i; // opening quote
+        while (i < s.size()) {
+            const char c = s[i++];
+            if (c == '"') return true;
+            if (static_cast<unsigned char>(c) < 0x20) return false;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (i >= s.size()) return false;
+            switch (const char e = s[i++]) {
+                case '"': case '\\': case '/': out += e; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    char32_t cp;
+                    if (!hex4(cp) || (cp >= 0xDC00 && cp <= 0xDFFF)) return false;
+                    if (cp >= 0xD800 && cp <= 0xDBFF) {
+                        char32_t low;
+                        if (charAt(s, i) != '\\' || charAt(s, i + 1) != 'u') return false;
+                        i += 2;
+                        if (!hex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    char buf[4];
+                    out.append(buf, encodeUtf8(cp, buf));
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    };
+
+    fields.clear();
+    skipSpace();
+    if (charAt(s, i) != '{') {
+        error = "expected a JSON object";
+        return false;
+    }
+    ++i;
+    skipSpace();
+    if (charAt(s, i) == '}') {
+        ++i;
+    } else {
+        for (;;) {
+            skipSpace();
+            std::pair<std::string, std::string> field;
+            if (charAt(s, i) != '"' || !parseString(field.first)) {
+                error = "bad key";
+                return false;
+            }
+            skipSpace();
+            if (charAt(s, i) != ':') {
+                error = "expected ':' after \"" + field.first + "\"";
+                return false;
+            }
+            ++i;
+            skipSpace();
+            const char c = charAt(s, i);
+            if (c == '"') {
+                if (!parseString(field.second)) {
+                    error = "bad string for \"" + field.first + "\"";
+                    return false;
+                }
+            } else if (c == '{' || c == '[') {
+                error = "nested values are not supported (\"" + field.first + "\")";
+                return false;
+            } else {
+                const size_t start = i;
+                while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ' ' && s[i] != '\t') ++i;
+                field.second.assign(s.substr(start, i - start));
+                double number;
+                const char *first = field.second.data(), *last = first + field.second.size();
+                const auto [end, ec] = std::from_chars(first, last, number);
+                const bool isNumber = ec == std::errc() && end == last;
+                if (!isNumber && field.second != "true" && field.second != "false" && field.second != "null") {
+                    error = "bad value for \"" + field.first + "\"";
+                    return false;
+                }
+            }
+            fields.push_back(std::move(field));
+            skipSpace();
+            if (charAt(s, i) == ',') {
+                ++i;
+                continue;
+            }
+            if (charAt(s, i) == '}') {
+                ++i;
+                break;
+            }
+            error = "expected ',' or '}'";
+            return false;
+        }
+    }
+    skipSpace();
+    if (i != s.size()) {
+        error = "trailing characters after the object";
+        return false;
+    }
+    return true;
+}
+
+static void appendJsonString(std::string &out, std::string_view text) {
+    out += '"';
+    for (const char c: text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    static constexpr char hex[] = "0123456789abcdef";
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 15];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// Takes the job keys out of a parsed object; unknown keys are ignored.
+static bool speechJobFromFields(std::vector<std::pair<std::string, std::string> > &fields, SpeechJob &job,
+                                std::string &error) {
+    int payloads = 0;
+    for (auto &[key, value]: fields) {
+        if (key == "text") {
+            job.text = std::move(value);
+            ++payloads;
+        } else if (key == "spell") {
+            job.spell = std::move(value);
+            ++payloads;
+        } else if (key == "number") {
+            const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), job.number);
+            if (ec != std::errc() || end != value.data() + value.size()) {
+                error = "\"number\" must be an integer";
+                return false;
+            }
+            job.hasNumber = true;
+            ++payloads;
+        } else if (key == "voice") {
+            job.options.voice = std::move(value);
+        } else if (key == "rate" || key == "pitch") {
+            int &field = key == "rate" ? job.options.rate : job.options.pitch;
+            const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), field);
+            if (ec != std::errc() || end != value.data() + value.size() || field <= 0) {
+                error = "\"" + key + "\" must be a positive integer";
+                return false;
+            }
+        } else if (key == "output") {
+            job.output = std::move(value);
+        } else if (key == "id") {
+            job.id = std::move(value);
+        }
+    }
+    if (payloads != 1) {
+        error = "expected exactly one of \"text\", \"number\" or \"spell\"";
+        return false;
+    }
+    return true;
+}
+
+// Fills job from one input line. Blank lines and '#' comments return false
+// with an empty error.
+static bool parseSpeechJob(std::string_view line, SpeechJob &job, std::string &error) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.remove_suffix(1);
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t')) line.remove_prefix(1);
+    if (line.empty() || line[0] == '#') return false;
+    if (line[0] != '{') {
+        job.text.assign(line);
+        return true;
+    }
+
+    std::vector<std::pair<std::string, std::string> > fields;
+    return parseFlatJsonObject(line, fields, error) && speechJobFromFields(fields, job, error);
+}
+
+// Turns a job into engine input. Returns whether spoken is engine markup.
+static bool prepareSpeechJob(const SpeechJob &job, const PronunciationLexicon *lexicon, std::string &spoken) {
+    spoken.clear();
+    if (job.hasNumber) {
+        appendNumberWords(spoken, job.number);
+        return false;
+    }
+    if (!job.spell.empty()) {
+        std::string spelled(spellInto(nullptr, job.spell, Spelling::Letters, 0, true), '\0');
+        spellInto(spelled.data(), job.spell, Spelling::Letters, 0, true);
+        translateSpeechMarkup(spelled, kPlatformSpeechEngine, spoken, lexicon);
+        return kPlatformSpeechEngine != SpeechEngine::MacSay;
+    }
+    normalizeForSpeech(job.text, spoken, lexicon);
+    return false;
+}
+
+// Prepares and (unless dryRun) speaks one job. Writes its status line to
+// line and returns whether it succeeded.
+static bool runSpeechJob(const SpeechJob &job, bool dryRun, const PronunciationLexicon *lexicon, std::string &line) {
+    const auto start = std::chrono::steady_clock::now();
+    std::string spoken;
+    const bool markup = prepareSpeechJob(job, lexicon, spoken);
+
+    int status = 0;
+    if (!dryRun) status = runSpeechEngine(spoken, markup, job.options, job.output);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    line = "{\"line\":";
+    line += std::to_string(job.line);
+    if (!job.id.empty()) {
+        line += ",\"id\":";
+        appendJsonString(line, job.id);
+    }
+    if (status == 0) {
+        line += ",\"status\":\"ok\"";
+    } else {
+        line += ",\"status\":\"error\",\"error\":\"engine exited with status ";
+        line += std::to_string(status);
+        line += '"';
+    }
+    if (!job.output.empty()) {
+        line += ",\"output\":";
+        appendJsonString(line, job.output);
+    }
+    if (dryRun) {
+        line += ",\"spoken\":";
+        appendJsonString(line, spoken);
+    }
+    char elapsed[32];
+    std::snprintf(elapsed, sizeof(elapsed), ",\"ms\":%.2f}\n", ms);
+    line += elapsed;
+    return status == 0;
+}
+
+// Runs every job in input on jobs worker threads. Returns the process exit
+// code: 0 when all jobs succeeded, 1 otherwise.
+static int runSpeechBatch(std::istream &input, unsigned jobs, bool dryRun) {
+    ThreadPool pool(jobs);
+    const auto lexicon = pronunciationLexicon();
+
+    // Bound the queue so millions of input lines are never all in memory
+    const size_t maxInFlight = 4 * static_cast<size_t>(pool.size());
+    std::mutex mutex;
+    std::condition_variable drained;
+    size_t inFlight = 0, total = 0, failed = 0;
+
+    auto emit = [&](const std::string &status) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::fwrite(status.data(), 1, status.size(), stdout);
+        std::fflush(stdout);
+    };
+
+    std::string line, error;
+    size_t lineNo = 0;
+    while (std::getline(input, line)) {
+        ++lineNo;
+        SpeechJob job;
+        job.line = lineNo;
+        error.clear();
+        if (!parseSpeechJob(line, job, error)) {
+            if (error.empty()) continue;
+            std::string status = "{\"line\":" + std::to_string(lineNo) + ",\"status\":\"error\",\"error\":";
+            appendJsonString(status, error);
+            status += "}\n";
+            emit(status);
+            std::lock_guard<std::mutex> lock(mutex);
+            ++total;
+            ++failed;
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            drained.wait(lock, [&] { return inFlight < maxInFlight; });
+            ++inFlight;
+            ++total;
+        }
+        pool.submit([&, job = std::move(job)] {
+            std::string status;
+            const bool ok = runSpeechJob(job, dryRun, lexicon.get(), status);
+            emit(status);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --inFlight;
+                if (!ok) ++failed;
+            }
+            drained.notify_all();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [&] { return inFlight == 0; });
+    std::fprintf(stderr, "%zu jobs, %zu failed\n", total, failed);
+    return failed ? 1 : 0;
+}
+
+#if defined(__linux__)
+// ---- Speech daemon -------------------------------------------------------------
+// untitled --serve path [--workers N] [--lexicon file]
+//
+// Listens on a Unix stream socket. Messages in both directions are frames: a
+// 4-byte big-endian length, then that many bytes of JSON. Requests are flat
+// objects with an "op" and an optional "id" that is echoed back:
+//
+//   {"op":"words","number":1408}              {"status":"ok","result":"one thousand ..."}
+//   {"op":"normalize","text":"Dr. X, $5"}     {"status":"ok","result":"Doctor X, five dollars"}
+//   {"op":"spell","text":"AB1","mode":"nato"} {"status":"ok","result":"Alpha Bravo one"}
+//   {"op":"speak","text":"Hello"}             {"status":"ok"} once spoken
+//   {"op":"synth","text":"Hello"}             {"status":"ok","result":"<wav path>","cached":false}
+//
+// speak and synth take "number" or "spell" instead of "text", plus "voice",
+// "rate", "pitch" and "output", as in --batch. The cheap ops are answered on the event loop;
+// speak and synth run on the worker pool, so their responses can overtake
+// earlier requests on the same connection; match them up by "id". synth
+// without "output" writes into <path>.cache/ and keeps the most recent files
+// in an LRU, so repeated prompts skip the engine.
+
+// Synthesized audio files by speech options and prepared text, least recently used
+// evicted (and deleted) first. Shared by all workers.
+class SynthCache {
+public:
+    SynthCache(std::string dir, size_t capacity) : dir_(std::move(dir)), capacity_(capacity) {}
+
+    // Sets path to the audio for key, calling make(path) to produce it on a
+    // miss. Returns false when make fails.
+    bool fetch(const std::string &key, const std::function<bool(const std::string &)> &make, std::string &path,
+               bool &cached) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = index_.find(key);
+            if (found != index_.end()) {
+                lru_.splice(lru_.begin(), lru_, found->second);
+                path = found->second->path;
+                cached = true;
+                return true;
+            }
+        }
+
+        // Synthesize outside the lock into a file of its own; the serial keeps
+        // keys whose hashes collide (and concurrent misses on one key) apart.
+        cached = false;
+        char name[48];
+        std::snprintf(name, sizeof(name), "/%016llx-%u.wav",
+                      static_cast<unsigned long long>(std::hash<std::string>{}(key)), counter_.fetch_add(1));
+        path = dir_ + name;
+        if (!make(path)) {
+            std::remove(path.c_str());
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (auto found = index_.find(key); found != index_.end()) {
+            // Another worker published this key first; use its file
+            std::remove(path.c_str());
+            path = found->second->path;
+            return true;
+        }
+        lru_.push_front({key, path});
+        index_.emplace(key, lru_.begin());
+        while (lru_.size() > capacity_) {
+            std::remove(lru_.back().path.c_str());
+            index_.erase(lru_.back().key);
+            lru_.pop_back();
+        }
+        return true;
+    }
+
+    const std::string &dir() const { return dir_; }
+
+private:
+    struct Entry {
+        std::string key;
+        std::string path;
+    };
+
+    std::string dir_;
+    size_t capacity_;
+    std::atomic<unsigned> counter_{0};
+    std::mutex mutex_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+class SpeechServer {
+public:
+    SpeechServer(std::string path, unsigned workers)
+        : path_(std::move(path)), workers_(workers), cache_(path_ + ".cache", 1024) {}
+
+    SpeechServer(const SpeechServer &) = delete;
+    SpeechServer &operator=(const SpeechServer &) = delete;
+
+    // Serves until SIGINT or SIGTERM. Returns the process exit code.
+    int run() {
+        // Signals arrive through a signalfd, so block them before any thread
+        // (the pool's, or the engine's via system()) can inherit another mask.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path_.size() >= sizeof(addr.sun_path)) {
+            std::fprintf(stderr, "socket path too long: %s\n", path_.c_str());
+            return 2;
+        }
+        std::memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+        listenFd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        ::unlink(path_.c_str()); // stale socket from an earlier run
+        if (listenFd_ < 0 || ::bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listenFd_, SOMAXCONN) != 0) {
+            std::perror(path_.c_str());
+            return 2;
+        }
+        ::mkdir(cache_.dir().c_str(), 0700);
+
+        epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        wakeFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        signalFd_ = ::signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        watch(listenFd_, kListenId, EPOLLIN);
+        watch(wakeFd_, kWakeId, EPOLLIN);
+        watch(signalFd_, kSignalId, EPOLLIN);
+        pool_ = std::make_unique<ThreadPool>(workers_);
+        lexicon_ = pronunciationLexicon();
+        std::fprintf(stderr, "listening on %s with %u workers\n", path_.c_str(), pool_->size());
+
+        epoll_event events[64];
+        bool stopping = false;
+        while (!stopping) {
+            const int n = ::epoll_wait(epollFd_, events, 64, -1);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; ++i) {
+                const uint64_t id = events[i].data.u64;
+                if (id == kListenId) {
+                    acceptAll();
+                } else if (id == kWakeId) {
+                    deliverCompletions();
+                } else if (id == kSignalId) {
+                    stopping = true;
+                } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    readFrom(id);
+                } else if (events[i].events & EPOLLOUT) {
+                    auto found = connections_.find(id);
+                    if (found == connections_.end()) continue;
+                    flush(found->second);
+                    if (done(found->second)) close(found->second);
+                }
+            }
+        }
+
+        pool_.reset(); // finishes queued jobs
+        for (auto &[id, conn]: connections_) ::close(conn.fd);
+        ::close(signalFd_);
+        ::close(wakeFd_);
+        ::close(epollFd_);
+        ::close(listenFd_);
+        ::unlink(path_.c_str());
+        return 0;
+    }
+
+private:
+    static constexpr uint64_t kListenId = 0, kWakeId = 1, kSignalId = 2;
+    static constexpr size_t kMaxFrame = 1 << 20;
+
+    struct Connection {
+        int fd = -1;
+        uint64_t id = 0;
+        std::string in;
+        size_t inPos = 0;
+        std::string out;
+        size_t outPos = 0;
+        size_t jobs = 0;      // speak/synth requests still on the pool
+        bool writing = false; // EPOLLOUT armed
+        bool eof = false;     // peer has shut down its side; answer what was sent, then close
+        bool broken = false;  // send failed; close once the caller is done with it
+    };
+
+    struct Completion {
+        uint64_t connection;
+        std::string frame;
+    };
+
+    void watch(int fd, uint64_t id, uint32_t events, int op = EPOLL_CTL_ADD) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        ::epoll_ctl(epollFd_, op, fd, &ev);
+    }
+
+    // Stops reading after EOF, so a half-closed socket does not keep firing.
+    void rearm(Connection &conn) {
+        watch(conn.fd, conn.id, (conn.eof ? 0u : EPOLLIN) | (conn.writing ? EPOLLOUT : 0u), EPOLL_CTL_MOD);
+    }
+
+    // True once nothing more will be read from or written to conn.
+    static bool done(const Connection &conn) {
+        return conn.broken || (conn.eof && !conn.jobs && conn.outPos == conn.out.size());
+    }
+
+    void acceptAll() {
+        for (;;) {
+            const int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;
+            const uint64_t id = nextId_++;
+            Connection &conn = connections_[id];
+            conn.fd = fd;
+            conn.id = id;
+            watch(fd, id, EPOLLIN);
+        }
+    }
+
+    void close(Connection &conn) {
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+        connections_.erase(conn.id);
+    }
+
+    void readFrom(uint64_t id) {
+        auto found = connections_.find(id);
+        if (found == connections_.end()) return;
+        Connection &conn = found->second;
+        if (conn.eof) {
+            // Only EPOLLHUP/EPOLLERR get here after EOF: the peer is gone entirely
+            close(conn);
+            return;
+        }
+
+        // On EOF (a client may shut down writing after its last request)
+        // the buffered frames are still answered before the connection closes.
+        char buf[64 * 1024];
+        bool eof = false;
+        for (;;) {
+            const ssize_t got = ::recv(conn.fd, buf, sizeof(buf), 0);
+            if (got > 0) {
+                conn.in.append(buf, static_cast<size_t>(got));
+                continue;
+            }
+            if (got == 0) {
+                eof = true;
+                break;
+            }
+            if (errno == EAGAIN || errno == EINTR) break;
+            close(conn);
+            return;
+        }
+
+        while (conn.in.size() - conn.inPos >= 4) {
+            const auto *p = reinterpret_cast<const unsigned char *>(conn.in.data() + conn.inPos);
+            const size_t len = static_cast<size_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+            if (len > kMaxFrame) {
+                close(conn);
+                return;
+            }
+            if (conn.in.size() - conn.inPos < 4 + len) break;
+            const std::string_view payload(conn.in.data() + conn.inPos + 4, len);
+            conn.inPos += 4 + len;
+            handle(conn, payload);
+            if (conn.broken) {
+                close(conn);
+                return;
+            }
+        }
+        // Drop consumed bytes once they dominate the buffer
+        if (conn.inPos > conn.in.size() / 2) {
+            conn.in.erase(0, conn.inPos);
+            conn.inPos = 0;
+        }
+        if (eof) {
+            conn.eof = true;
+            rearm(conn);
+            if (done(conn)) close(conn);
+        }
+    }
+
+    static std::string frame(std::string_view id, bool ok, std::string_view result, std::string_view extra = {}) {
+        std::string json = "{";
+        if (!id.empty()) {
+            json += "\"id\":";
+            appendJsonString(json, id);
+            json += ',';
+        }
+        json += ok ? "\"status\":\"ok\"" : "\"status\":\"error\"";
+        if (!result.empty()) {
+            json += ok ? ",\"result\":" : ",\"error\":";
+            appendJsonString(json, result);
+        }
+        json += extra;
+        json += '}';
+
+        std::string out(4, '\0');
+        const size_t len = json.size();
+        out[0] = static_cast<char>(len >> 24);
+        out[1] = static_cast<char>(len >> 16);
+        out[2] = static_cast<char>(len >> 8);
+        out[3] = static_cast<char>(len);
+        return out + json;
+    }
+
+    void handle(Connection &conn, std::string_view payload) {
+        std::vector<std::pair<std::string, std::string> > fields;
+        std::string error;
+        if (!parseFlatJsonObject(payload, fields, error)) return send(conn, frame({}, false, error));
+
+        std::string op, id, mode, group;
+        for (auto &[key, value]: fields) {
+            if (key == "op") op = value;
+            else if (key == "id") id = value;
+            else if (key == "mode") mode = value;
+            else if (key == "group") group = value;
+        }
+
+        if (op == "speak" || op == "synth") {
+            SpeechJob job;
+            if (!speechJobFromFields(fields, job, error)) return send(conn, frame(id, false, error));
+            ++conn.jobs;
+            pool_->submit([this, connection = conn.id, synth = op == "synth", job = std::move(job)] {
+                complete(connection, synth ? synthesize(job) : speak(job));
+            });
+            return;
+        }
+
+        std::string text;
+        long long number = 0;
+        bool hasNumber = false;
+        for (const auto &[key, value]: fields) {
+            if (key == "text" || key == "spell") text = value;
+            if (key == "number") {
+                const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+                hasNumber = ec == std::errc() && end == value.data() + value.size();
+            }
+        }
+        if (op == "words") {
+            if (!hasNumber) return send(conn, frame(id, false, "\"number\" must be an integer"));
+            return send(conn, frame(id, true, numberToWords(number)));
+        }
+        if (op == "normalize") {
+            normalizeForSpeech(text, scratch_, lexicon_.get());
+            return send(conn, frame(id, true, scratch_));
+        }
+        if (op == "spell") {
+            const Spelling spelling = mode == "nato" ? Spelling::Nato : mode == "asin" ? Spelling::AsIn : Spelling::Letters;
+            return send(conn, frame(id, true, spellOut(text, spelling, std::atoi(group.c_str()))));
+        }
+        send(conn, frame(id, false, op.empty() ? "missing \"op\"" : "unknown op \"" + op + "\""));
+    }
+
+    // Worker side: run the engine and hand the response back to the loop.
+    std::string speak(const SpeechJob &job) {
+        std::string spoken;
+        const bool markup = prepareSpeechJob(job, lexicon_.get(), spoken);
+        const int status = runSpeechEngine(spoken, markup, job.options, job.output);
+        if (status == 0) return frame(job.id, true, {});
+        return frame(job.id, false, "engine exited with status " + std::to_string(status));
+    }
+
+    std::string synthesize(const SpeechJob &job) {
+        std::string spoken, error;
+        const bool markup = prepareSpeechJob(job, lexicon_.get(), spoken);
+        // An engine can exit 0 without writing anything, so check the file too
+        auto make = [&](const std::string &path) {
+            const int status = runSpeechEngine(spoken, markup, job.options, path);
+            struct stat info;
+            if (status != 0) error = "engine exited with status " + std::to_string(status);
+            else if (::stat(path.c_str(), &info) != 0 || info.st_size == 0) error = "engine produced no output";
+            return error.empty();
+        };
+        if (!job.output.empty()) {
+            if (make(job.output)) return frame(job.id, true, job.output);
+        } else {
+            std::string path;
+            bool cached = false;
+            std::string key;
+            appendSpeechOptionsKey(key, resolveSpeechOptions(job.options));
+            key += '\0';
+            key += spoken;
+            if (cache_.fetch(key, make, path, cached))
+                return frame(job.id, true, path, cached ? ",\"cached\":true" : ",\"cached\":false");
+        }
+        return frame(job.id, false, error);
+    }
+
+    void complete(uint64_t connection, std::string response) {
+        {
+            std::lock_guard<std::mutex> lock(completionMutex_);
+            completions_.push_back({connection, std::move(response)});
+        }
+        const uint64_t one = 1;
+        [[maybe_unused]] const ssize_t written = ::write(wakeFd_, &one, sizeof(one));
+    }
+
+    void deliverCompletions() {
+        uint64_t count;
+        [[maybe_unused]] const ssize_t got = ::read(wakeFd_, &count, sizeof(count));
+        std::vector<Completion> ready;
+        {
+            std::lock_guard<std::mutex> lock(completionMutex_);
+            ready.swap(completions_);
+        }
+        for (Completion &c: ready) {
+            auto found = connections_.find(c.connection);
+            if (found == connections_.end()) continue; // client has left
+            --found->second.jobs;
+            send(found->second, std::move(c.frame));
+            if (done(found->second)) close(found->second);
+        }
+    }
+
+    void send(Connection &conn, std::string bytes) {
+        if (conn.outPos == conn.out.size()) {
+            conn.out.clear();
+            conn.outPos = 0;
+        }
+        conn.out += bytes;
+        flush(conn);
+    }
+
+    void flush(Connection &conn) {
+        while (conn.outPos < conn.out.size()) {
+            const ssize_t sent = ::send(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos,
+                                        MSG_NOSIGNAL);
+            if (sent > 0) {
+                conn.outPos += static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EINTR)) break;
+            conn.broken = true;
+            return;
+        }
+        const bool pending = conn.outPos < conn.out.size();
+        if (pending != conn.writing) {
+            conn.writing = pending;
+            rearm(conn);
+        }
+    }
+
+    std::string path_;
+    unsigned workers_;
+    SynthCache cache_;
+    std::unique_ptr<ThreadPool> pool_;
+    std::shared_ptr<const PronunciationLexicon> lexicon_;
+    std::string scratch_;
+
+    int listenFd_ = -1, epollFd_ = -1, wakeFd_ = -1, signalFd_ = -1;
+    uint64_t nextId_ = 3;
+    std::unordered_map<uint64_t, Connection> connections_;
+
+    std::mutex completionMutex_;
+    std::vector<Completion> completions_;
+};
+#endif
+
+static int printUsage(FILE *to) {
+    std::fputs("usage: untitled                     run the demo\n"
+               "       untitled --batch [file|-] [--jobs N] [--dry-run] [--lexicon file]\n"
+#if defined(__linux__)
+               "       untitled --serve socket-path [--workers N] [--lexicon file]\n"
+#endif
+               "       untitled --bench-decode N file...\n"
+               "  --voice name, --rate wpm and --pitch 1-99 set the defaults for --batch and --serve jobs\n"
+               , to);
+    return to == stderr ? 2 : 0;
+}
+
+// Dispatches the command-line modes; the demo runs when there are none.
+static int runCommandLine(int argc, char **argv) {
+    std::string batchPath, servePath;
+    bool batch = false, dryRun = false;
+    unsigned jobs = 0;
+    SpeechOptions defaults;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--batch") {
+            batch = true;
+            batchPath = "-";
+            if (hasValue && (argv[i + 1][0] != '-' || std::string_view(argv[i + 1]) == "-")) batchPath = argv[++i];
+        } else if (arg == "--serve" && hasValue) {
+            servePath = argv[++i];
+        } else if ((arg == "--jobs" || arg == "--workers") && hasValue) {
+            const std::string_view value = argv[++i];
+            const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), jobs);
+            if (ec != std::errc() || end != value.data() + value.size()) return printUsage(stderr);
+        } else if (arg == "--voice" && hasValue) {
+            defaults.voice = argv[++i];
+        } else if ((arg == "--rate" || arg == "--pitch") && hasValue) {
+            const std::string_view value = argv[++i];
+            int &field = arg == "--rate" ? defaults.rate : defaults.pitch;
+            const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), field);
+            if (ec != std::errc() || end != value.data() + value.size() || field <= 0) return printUsage(stderr);
+        } else if (arg == "--dry-run") {
+            dryRun = true;
+        } else if (arg == "--lexicon" && hasValue) {
+            auto lexicon = std::make_shared<PronunciationLexicon>();
+            if (!lexicon->load(argv[++i])) {
+                std::fprintf(stderr, "cannot load lexicon %s\n", argv[i]);
+                return 2;
+            }
+            setPronunciationLexicon(std::move(lexicon));
+        } else if (arg == "--bench-decode" && hasValue) {
+            const int rounds = std::atoi(argv[++i]);
+            if (rounds < 1 || i + 1 >= argc) return printUsage(stderr);
+            return runDecodeBenchmark(std::vector<std::string>(argv + i + 1, argv + argc), rounds);
+        } else if (arg == "--help" || arg == "-h") {
+            return printUsage(stdout);
+        } else {
+            return printUsage(stderr);
+        }
+    }
+    setSpeechDefaults(std::move(defaults));
+#if defined(__linux__)
+    if (!servePath.empty() && !batch) return SpeechServer(servePath, jobs).run();
+#endif
+    if (!batch || !servePath.empty()) return printUsage(stderr);
+
+    if (batchPath == "-") return runSpeechBatch(std::cin, jobs, dryRun);
+    std::ifstream file(batchPath);
+    if (!file) {
+        std::fprintf(stderr, "cannot open %s\n", batchPath.c_str());
+        return 2;
+    }
+    return runSpeechBatch(file, jobs, dryRun);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) return runCommandLine(argc, argv);
+
+    auto lang = "C++";
+    std::cout << "Hello and welcome to " << lang << "!\n";
+
+    SpeechScheduler speech;
+
+    for (int i = 1; i <= 1; i++) {
+        std::cout << i << " -> " << numberToWords(i) << '\n';
+        speech.say("Counting a number:");
+        speech.sayNumber(i);
+    }
+
+    int n = 300;
+    int d = 1408;
+
+    std::cout << n << " -> " << numberToWords(n) << '\n';
+    std::cout << d << " -> " << numberToWords(d) << '\n';
+
+    speech.sayNumber(n);
+    speech.sayNumber(d);
+
+    std::string w = "Morizo";
+    std::cout << w << " -> " << lettersSeparated(w, ' ', true) << '\n';
+
+    // The engine guesses at brand names; respell them before they reach it
+    auto lexicon = std::make_shared<PronunciationLexicon>();
+    if (lexicon->build({{"Morizo", "Moh-ree-zoh"}})) setPronunciationLexicon(lexicon);
+    std::cout << w << " -> " << lexicon->lookup(w) << " (lexicon)\n";
+
+    speech.saySpelled(w);
+    speech.say(w);
+    std::cout << w << " -> " << spellOut(w, Spelling::AsIn) << '\n';
+    speech.saySpelled(w, Spelling::AsIn);
+
+    const std::string serial = "AB12C34";
+    std::cout << serial << " -> " << spellOut(serial, Spelling::Nato, 4) << '\n';
+
+    SpeechMarkup markup;
+    markup.text("Ready").pause(300).prosody(150).text("this part is fast").endProsody().emphasis("then stop");
+    std::cout << markup.str() << '\n';
+    speech.sayMarkup(markup.str());
+
+    const std::string note = "Dr. Morizo paid $1,408.50 on 2024-05-01 at 10:05 am.";
+    std::cout << note << " -> " << normalizeForSpeech(note) << '\n';
+    speech.say(note, {.voice = {}, .rate = 220, .pitch = 0});
+
+    speech.flush();
+    std::cout << "Speech: " << speech.utterances() << " utterances in " << speech.engineCalls()
+              << " engine calls (" << speech.duplicates() << " duplicates dropped)\n";
+
+    drawSquare(5);
+    std::cout << '\n';
+    drawSquare(6, '*', false);
+
+    std::cout << "Outline circle (r=8):\n";
+    drawCircle(8, '*', false);
+
+    std::cout << "\nFilled circle (r=6):\n";
+    drawCircle(6, '#', true);
+
+    std::cout << "\nAnti-aliased circle (r=8):\n";
+    Canvas aa(circleWidth(8) + 2, 2 * 8 + 3);
+    drawCircleAA(aa, aa.cols() / 2, aa.rows() / 2, 8);
+    aa.flush();
+
+    std::cout << "\nPrimitives:\n";
+    Canvas scene(60, 18);
+    DisplayList primitives;
+    primitives.addRect(0, 0, 60, 18, '.', false);
+    primitives.addPolygon({{4, 15}, {14, 3}, {24, 15}}, '^');
+    primitives.addEllipse({38, 9}, 12, 5, 0.5f, 'o', true);
+    primitives.add({22, 1, 54, 17}, [](Canvas &c) { drawArc(c, {38, 9}, 15, 7, 0, std::numbers::pi_v<float>, '~'); });
+    primitives.addLine(2, 2, 57, 16, '/');
+    primitives.addLineAA(2.5f, 16.5f, 57.5f, 1.5f);
+    ThreadPool pool(2);
+    renderTiled(scene, primitives, pool, 16, 6);
+    scene.flush();
+
+
+    std::cout << "Heart x1:\n";
+    renderAsciiArt(kHeartSprite, 1, 1, '@', ' ');
+
+    std::cout << "\nHeart x2 (scaled):\n";
+    renderAsciiArt(kHeartSprite, 2, 2, '*', ' ');
 
     std::cout << "\nSmiley x1:\n";
-    renderAsciiArt(smiley, 1, 1, '#', ' ');
+    renderAsciiArt(kSmileySprite, 1, 1, '#', ' ');
+
+    std::cout << "\nHeart resized to 27x10 (bilinear):\n";
+    Canvas resized(27, 10);
+    renderAsciiArtResized(resized, 0, 0, kHeartSprite, 27, 10, Resample::Bilinear, '@');
+    resized.flush();
+
+    std::cout << "\nBanner (" << numberToWords(d) << "):\n";
+    renderBanner(std::to_string(d) + "\n" + w + "!").flush();
+
+    {
+        // Growing circle animation, measured rather than shown.
+        TerminalRenderer terminal(nullptr);
+        Canvas frame(81, 21);
+        size_t fullBytes = 0;
+        for (int r = 1; r <= 10; ++r) {
+            frame.clear();
+            drawRect(frame, 0, 0, frame.cols(), frame.rows(), '+', false);
+            drawCircle(frame, 40, 10, r, '*', true);
+            terminal.present(frame);
+            fullBytes += frame.size();
+        }
+        std::cout << "\nAnimation: " << terminal.frames() << " frames, " << terminal.totalBytes()
+                  << " bytes with diffing vs " << fullBytes << " full redraws (last frame "
+                  << terminal.lastFrameBytes() << " bytes)\n";
+    }
+
+    std::cout << "\nStatus row (sprite atlas):\n";
+    enum SpriteId : std::uint32_t { kHeartId, kSmileyId };
+    SpriteAtlas atlas(4096);
+    Canvas status(4 * 12 + 10, 8);
+    for (int i = 0; i < 4; ++i) atlas.blit(status, i * 12, 0, kHeartId, kHeartSprite, 1, 1, '@');
+    atlas.blit(status, 48, 0, kSmileyId, kSmileySprite);
+    status.flush();
+    std::cout << "atlas: " << atlas.hits() << " hits, " << atlas.misses() << " misses, "
+              << atlas.bytesUsed() << " bytes\n";
+
+    ImageBatchPlan plan = planImageBatch({findResource("puppy.png"), findResource("golde.png")}, 72);
+    decodeImageBatch(plan);
+    for (const auto &job: plan.jobs) {
+        std::cout << "\n" << job.info.path << " (" << job.info.width << "x" << job.info.height << "):\n";
+        std::cout.write(plan.grid(job), static_cast<std::streamsize>(job.gridBytes()));
+    }
+    if (!plan.jobs.empty()) {
+        const ImageJob &job = plan.jobs.back();
+        std::string colored;
+        imageToAnsi(plan.pixels(job), job.info.width, job.info.height, job.info.channels,
+                    job.gridCols, job.gridRows, ColorMode::Palette256, colored);
+        std::cout << "\n" << job.info.path << " (256 colors):\n" << colored;
+    }
+    if (!plan.jobs.empty()) {
+        const ImageJob &job = plan.jobs.back();
+        std::vector<unsigned char> lum = luminanceGrid(plan.pixels(job), job.info.width, job.info.height,
+                                                       job.info.channels, job.gridCols, job.gridRows);
+        std::string dithered(job.gridBytes(), ' ');
+        ditherToRamp(lum.data(), job.gridCols, job.gridRows, Dither::FloydSteinberg, dithered.data());
+        std::cout << "\n" << job.info.path << " (Floyd-Steinberg):\n" << dithered;
+    }
+
+    std::string cells;
+    bitmapToBraille(circleBitmap(12), cells);
+    std::cout << "\nBraille circle (r=12):\n" << cells;
+    cells.clear();
+    bitmapToHalfBlocks(patternBitmap(kHeartSprite), cells);
+    std::cout << "\nHalf-block heart:\n" << cells;
+    if (!plan.jobs.empty()) {
+        const ImageJob &job = plan.jobs.front();
+        cells.clear();
+        bitmapToBraille(thresholdImage(plan.pixels(job), job.info.width, job.info.height, job.info.channels,
+                                       job.gridCols * 2, job.gridRows * 4), cells);
+        std::cout << "\n" << job.info.path << " (braille):\n" << cells;
+    }
+    for (const auto &[path, reason]: plan.rejected)
+        std::cout << "Skipped " << path << ": " << reason << '\n';
 
     return 0;
 }